@@ -0,0 +1,288 @@
+/*
+ * microbenchmarks of fbff's hot loops
+ *
+ * Run with "make microbench".  Each kernel is run until BENCHMIN
+ * milliseconds pass to warm up the caches and to find the number of
+ * iterations of a repetition; the fastest of BENCHREPS repetitions is
+ * reported in nanoseconds per written pixel and gigabytes written per
+ * second.  Rows are drawn to memory; with -f, they are drawn to the
+ * framebuffer (FBDEV or /dev/fb0) too, overwriting the screen, since its
+ * memory is usually much slower than system memory.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+#include "blit.h"
+#include "draw.h"
+#include "ffs.h"
+#include "ring.h"
+
+#define BENCHREPS	5	/* measured repetitions */
+#define BENCHMIN	50	/* minimum duration of a repetition (ms) */
+
+#define LEN(a)		(sizeof(a) / sizeof((a)[0]))
+
+static int sizes[][2] = {{320, 240}, {640, 480}, {1280, 720}, {1920, 1080}};
+static unsigned fbms[] = {0x40888, 0x20565, 0x10233};
+static int mags[] = {2, 3};
+
+/* a benchmark */
+struct job {
+	int w, h, bpp, mag;
+	char *src;		/* source pixels */
+	char *dst;		/* destination pixels */
+	char *row;		/* magnified row */
+	int fb;			/* draw to the framebuffer */
+	struct SwsContext *swsc;
+	uint8_t *sdat[4], *ddat[4];
+	int slen[4], dlen[4];
+};
+
+static long ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000l + ts.tv_nsec;
+}
+
+/* draw_row(): copy the rows of a frame */
+static void rows(struct job *job)
+{
+	int len = job->w * job->bpp;
+	int r;
+	for (r = 0; r < job->h; r++) {
+		if (job->fb)
+			blit_row(fb_mem(r), fb_cols(), 0, job->src + r * len,
+				job->w, job->bpp);
+		else
+			blit_row(job->dst + r * len, job->w, 0, job->src + r * len,
+				job->w, job->bpp);
+	}
+}
+
+/* the magnify loop of draw_frame() */
+static void magnify(struct job *job)
+{
+	int len = job->w * job->mag * job->bpp;
+	int r, i;
+	for (r = 0; r < job->h; r++) {
+		blit_magnify(job->row, job->src + r * job->w * job->bpp,
+			job->w, job->mag, job->bpp);
+		for (i = 0; i < job->mag; i++)
+			memcpy(job->dst + (r * job->mag + i) * len, job->row, len);
+	}
+}
+
+/* the deinterlacing of ffs_vdec(), for one 8-bit plane */
+static void deint(struct job *job)
+{
+	int r;
+	for (r = 0; r < job->h; r++)
+		blit_deint(job->dst + r * job->w, job->src + (r ? r - 1 : r) * job->w,
+			job->src + r * job->w,
+			job->src + (r + 1 < job->h ? r + 1 : r) * job->w, job->w);
+}
+
+/* the conversion of ffs_vdec() */
+static void convert(struct job *job)
+{
+	sws_scale(job->swsc, (void *) job->sdat, job->slen, 0, job->h,
+		job->ddat, job->dlen);
+}
+
+/* run fn and report the fastest repetition; npix pixels are written */
+static void bench(char *name, void (*fn)(struct job *), struct job *job)
+{
+	long npix = (long) job->w * job->h * job->mag * job->mag;
+	long best = 0;
+	long n = 0, i;
+	long t0 = ns();
+	int k;
+	while (ns() - t0 < BENCHMIN * 1000000l) {
+		fn(job);
+		n++;
+	}
+	for (k = 0; k < BENCHREPS; k++) {
+		long t = ns();
+		for (i = 0; i < n; i++)
+			fn(job);
+		t = ns() - t;
+		if (!best || t < best)
+			best = t;
+	}
+	printf("%-12s %4dx%-4d %3d %3d %8.3f %8.2f\n", name, job->w, job->h,
+		job->bpp, job->mag, (double) best / n / npix,
+		(double) npix * job->bpp * n / best);
+}
+
+static void fill(char *buf, long len)
+{
+	long i;
+	for (i = 0; i < len; i++)
+		buf[i] = i * 7 + i / 4093;
+}
+
+static void bench_rows(int fb)
+{
+	int i, j;
+	for (i = 0; i < LEN(sizes); i++) {
+		struct job job = {sizes[i][0], sizes[i][1], 0, 1};
+		if (fb) {
+			job.bpp = FBM_BPP(fb_mode());
+			if (job.w > fb_cols() || job.h > fb_rows())
+				continue;
+		}
+		for (j = 0; j < LEN(fbms); j++) {
+			long len;
+			if (fb && FBM_BPP(fbms[j]) != job.bpp)
+				continue;
+			job.bpp = FBM_BPP(fbms[j]);
+			job.fb = fb;
+			len = (long) job.w * job.h * job.bpp;
+			job.src = malloc(len);
+			job.dst = malloc(len);
+			fill(job.src, len);
+			bench(fb ? "draw_row/fb" : "draw_row", rows, &job);
+			free(job.src);
+			free(job.dst);
+		}
+	}
+}
+
+static void bench_magnify(void)
+{
+	int i, j, k;
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < LEN(fbms); j++) {
+			for (k = 0; k < LEN(mags); k++) {
+				struct job job = {sizes[i][0], sizes[i][1]};
+				long len;
+				job.bpp = FBM_BPP(fbms[j]);
+				job.mag = mags[k];
+				len = (long) job.w * job.h * job.bpp;
+				job.src = malloc(len);
+				job.dst = malloc(len * job.mag * job.mag);
+				job.row = malloc(job.w * job.mag * job.bpp);
+				fill(job.src, len);
+				bench("magnify", magnify, &job);
+				free(job.src);
+				free(job.dst);
+				free(job.row);
+			}
+		}
+	}
+}
+
+static void bench_deint(void)
+{
+	int i;
+	for (i = 0; i < LEN(sizes); i++) {
+		struct job job = {sizes[i][0], sizes[i][1], 1, 1};
+		long len = (long) job.w * job.h;
+		job.src = malloc(len);
+		job.dst = malloc(len);
+		fill(job.src, len);
+		bench("deint", deint, &job);
+		free(job.src);
+		free(job.dst);
+	}
+}
+
+static void bench_convert(void)
+{
+	int i, j;
+	for (i = 0; i < LEN(sizes); i++) {
+		for (j = 0; j < LEN(fbms); j++) {
+			struct job job = {sizes[i][0], sizes[i][1], 0, 1};
+			int sfmt = AV_PIX_FMT_YUV420P;
+			int dfmt = ffs_pixfmt(fbms[j]);
+			job.bpp = FBM_BPP(fbms[j]);
+			job.swsc = sws_getContext(job.w, job.h, sfmt, job.w, job.h,
+				dfmt, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+			av_image_alloc(job.sdat, job.slen, job.w, job.h, sfmt, 16);
+			av_image_alloc(job.ddat, job.dlen, job.w, job.h, dfmt, 16);
+			fill((void *) job.sdat[0], job.slen[0] * job.h);
+			fill((void *) job.sdat[1], job.slen[1] * job.h / 2);
+			fill((void *) job.sdat[2], job.slen[2] * job.h / 2);
+			bench("sws_scale", convert, &job);
+			av_freep(&job.sdat[0]);
+			av_freep(&job.ddat[0]);
+			sws_freeContext(job.swsc);
+		}
+	}
+}
+
+/* the audio ring of fbff.c */
+
+#define RINGRUN		256		/* buffers passed in the benchmark */
+
+static char a_out[RING_LEN];	/* the audio device */
+static long a_lat;		/* the sum of handoff latencies */
+
+static void *ring_cons(void *dat)
+{
+	int i;
+	for (i = 0; i < RINGRUN; i++) {
+		char *buf;
+		long t;
+		int len;
+		ring_lock();
+		while (ring_empty())
+			ring_wait();
+		ring_unlock();
+		buf = ring_tail(&len);
+		memcpy(&t, buf, sizeof(t));
+		a_lat += ns() - t;
+		memcpy(a_out, buf, len);
+		ring_take();
+	}
+	return NULL;
+}
+
+static void bench_ring(void)
+{
+	pthread_t thread;
+	long t = ns();
+	int i;
+	if (ring_init(RING_LEN))
+		return;
+	pthread_create(&thread, NULL, ring_cons, NULL);
+	for (i = 0; i < RINGRUN; i++) {
+		long now;
+		ring_lock();
+		while (ring_full())
+			ring_wait();
+		ring_unlock();
+		memset(ring_head(), i, RING_LEN);
+		now = ns();
+		memcpy(ring_head(), &now, sizeof(now));
+		ring_put(RING_LEN);
+	}
+	pthread_join(thread, NULL);
+	t = ns() - t;
+	ring_free();
+	printf("audio ring: %d buffers of %dKiB, %.3f GB/s, %.3f ms handoff\n",
+		RINGRUN, RING_LEN >> 10, (double) RINGRUN * RING_LEN / t,
+		(double) a_lat / RINGRUN / 1000000);
+}
+
+int main(int argc, char *argv[])
+{
+	char *fbdev = getenv("FBDEV");
+	printf("%-12s %-9s %3s %3s %8s %8s\n", "kernel", "size", "bpp", "mag",
+		"ns/pixel", "GB/s");
+	bench_rows(0);
+	if (argc > 1 && !strcmp("-f", argv[1]) && !fb_init(fbdev)) {
+		bench_rows(1);
+		fb_free();
+	}
+	bench_magnify();
+	bench_deint();
+	bench_convert();
+	bench_ring();
+	return 0;
+}
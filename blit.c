@@ -0,0 +1,236 @@
+/*
+ * pixel kernels
+ *
+ * The kernels work on fb_mode() pixels and process the colour channels
+ * of each pixel together in a machine word, rather than one by one.
+ */
+#include <string.h>
+#include "blit.h"
+#include "draw.h"
+
+/* 8-8-8 pixels: red and blue are blended together, then green */
+static void blend32(unsigned *d, unsigned *s, unsigned char *a, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned x = s[i];
+		unsigned y = d[i];
+		unsigned k = a[i] + (a[i] >> 7);
+		unsigned rb, g;
+		if (k == 0)
+			continue;
+		if (k == 256) {
+			d[i] = x;
+			continue;
+		}
+		rb = ((x & 0xff00ff) * k + (y & 0xff00ff) * (256 - k)) >> 8;
+		g = ((x & 0x00ff00) * k + (y & 0x00ff00) * (256 - k)) >> 8;
+		d[i] = (y & 0xff000000) | (rb & 0xff00ff) | (g & 0x00ff00);
+	}
+}
+
+/* 5-6-5 pixels: green is moved to the upper half-word and all are blended */
+static void blend16(unsigned short *d, unsigned short *s, unsigned char *a, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned x = s[i];
+		unsigned y = d[i];
+		unsigned k = (a[i] + 4) >> 3;
+		if (k == 0)
+			continue;
+		if (k == 32) {
+			d[i] = x;
+			continue;
+		}
+		x = (x | (x << 16)) & 0x07e0f81f;
+		y = (y | (y << 16)) & 0x07e0f81f;
+		y = (y + (((x - y) * k) >> 5)) & 0x07e0f81f;
+		d[i] = y | (y >> 16);
+	}
+}
+
+/* 8-bit palette pixels cannot be mixed; the more opaque one wins */
+static void blend8(unsigned char *d, unsigned char *s, unsigned char *a, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		if (a[i] >= 128)
+			d[i] = s[i];
+}
+
+/* other pixels: each byte is blended separately */
+static void blendn(unsigned char *d, unsigned char *s, unsigned char *a, int n, int bpp)
+{
+	int i, j;
+	for (i = 0; i < n; i++) {
+		unsigned k = a[i] + (a[i] >> 7);
+		for (j = 0; j < bpp; j++, d++, s++)
+			*d = (*s * k + *d * (256 - k)) >> 8;
+	}
+}
+
+/* blend n src pixels into dst; alpha holds the opacity of src pixels */
+void blit_blend(void *dst, void *src, unsigned char *alpha, int n, unsigned fbm)
+{
+	int bpp = FBM_BPP(fbm);
+	if (bpp == 4)
+		blend32(dst, src, alpha, n);
+	else if (bpp == 2 && FBM_CLR(fbm) == 0x565)
+		blend16(dst, src, alpha, n);
+	else if (bpp == 1)
+		blend8(dst, src, alpha, n);
+	else
+		blendn(dst, src, alpha, n, bpp);
+}
+
+/* copy n src pixels to column c of dst, a row of cols pixels, clipping them */
+void blit_row(void *dst, int cols, int c, void *src, int n, int bpp)
+{
+	if (c < 0) {
+		n = -c < n ? n + c : 0;
+		src = (char *) src - c * bpp;
+		c = 0;
+	}
+	if (c + n > cols)
+		n = c < cols ? cols - c : 0;
+	memcpy((char *) dst + c * bpp, src, n * bpp);
+}
+
+/* repeat each of the n pixels of src mag times in dst */
+void blit_magnify(void *dst, void *src, int n, int mag, int bpp)
+{
+	char *d = dst;
+	char *s = src;
+	int c, i, k;
+	for (c = 0; c < n; c++)
+		for (i = 0; i < mag; i++)
+			for (k = 0; k < bpp; k++)
+				*d++ = s[c * bpp + k];
+}
+
+#define ROTBLK		32	/* rotation block size in pixels */
+
+/* copy n pixels from src, step bytes apart, to consecutive dst pixels */
+static void rotcopy(char *dst, char *src, int n, int step, int bpp)
+{
+	int i, j;
+	if (bpp == 4) {
+		for (i = 0; i < n; i++, src += step)
+			((unsigned *) dst)[i] = *(unsigned *) src;
+	} else if (bpp == 2) {
+		for (i = 0; i < n; i++, src += step)
+			((unsigned short *) dst)[i] = *(unsigned short *) src;
+	} else if (bpp == 1) {
+		for (i = 0; i < n; i++, src += step)
+			dst[i] = *src;
+	} else {
+		for (i = 0; i < n; i++, src += step)
+			for (j = 0; j < bpp; j++)
+				*dst++ = src[j];
+	}
+}
+
+/*
+ * rotate rn rows of cn pixels of src clockwise by rot degrees into dst
+ *
+ * The destination is written row by row, since framebuffer memory is
+ * slow to write randomly.  The source is read in ROTBLK blocks, so
+ * that the source rows of a block stay in the cache while the columns
+ * are read.
+ */
+void blit_rotate(void *dst, int dll, void *src, int sll,
+		int rn, int cn, int rot, int bpp)
+{
+	int dr = rot == 180 ? rn : cn;
+	int dc = rot == 180 ? cn : rn;
+	int y0, x0, y;
+	for (y0 = 0; y0 < dr; y0 += ROTBLK) {
+		for (x0 = 0; x0 < dc; x0 += ROTBLK) {
+			int n = dc - x0 < ROTBLK ? dc - x0 : ROTBLK;
+			int yn = dr - y0 < ROTBLK ? dr - y0 : ROTBLK;
+			for (y = y0; y < y0 + yn; y++) {
+				char *d = (char *) dst + y * dll + x0 * bpp;
+				char *s = src;
+				if (rot == 90) {
+					s += (rn - 1 - x0) * sll + y * bpp;
+					rotcopy(d, s, n, -sll, bpp);
+				} else if (rot == 270) {
+					s += x0 * sll + (cn - 1 - y) * bpp;
+					rotcopy(d, s, n, sll, bpp);
+				} else {
+					s += (rn - 1 - y) * sll + (cn - 1 - x0) * bpp;
+					rotcopy(d, s, n, -bpp, bpp);
+				}
+			}
+		}
+	}
+}
+
+/* load a machine word from p */
+static unsigned long word(unsigned char *p)
+{
+	unsigned long w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+/*
+ * find the first and the last different bytes of a and b
+ *
+ * Equal rows, the common case, are detected by memcmp(), which is
+ * vectorized by the C library; the bounds of different rows are then
+ * searched a machine word at a time.  Returns zero if a and b are equal.
+ */
+int blit_diff(void *a, void *b, int n, int *beg, int *end)
+{
+	unsigned char *x = a;
+	unsigned char *y = b;
+	int w = sizeof(unsigned long);
+	int i = 0;
+	int j = n;
+	if (!memcmp(a, b, n))
+		return 0;
+	while (i + w <= n && word(x + i) == word(y + i))
+		i += w;
+	while (x[i] == y[i])
+		i++;
+	while (j - w >= i && word(x + j - w) == word(y + j - w))
+		j -= w;
+	while (x[j - 1] == y[j - 1])
+		j--;
+	*beg = i;
+	*end = j;
+	return 1;
+}
+
+#define LOBITS		(~0ul / 0xff * 0x01)	/* the low bit of each byte */
+
+/* the byte-wise mean of a and b, rounded down */
+static unsigned long mean(unsigned long a, unsigned long b)
+{
+	return (a & b) + (((a ^ b) & ~LOBITS) >> 1);
+}
+
+/*
+ * linear blend deinterlacing: each byte of dst is (a + 2b + c) / 4,
+ * where b is the byte of the same row and a and c of the rows above
+ * and below
+ *
+ * The bytes of a machine word are averaged together without carries
+ * crossing byte boundaries; the bytes after the last whole word are
+ * averaged with the same function.
+ */
+void blit_deint(void *dst, void *a, void *b, void *c, int n)
+{
+	unsigned char *d = dst;
+	unsigned char *x = a, *y = b, *z = c;
+	int w = sizeof(unsigned long);
+	int i;
+	for (i = 0; i + w <= n; i += w) {
+		unsigned long m = mean(mean(word(x + i), word(z + i)), word(y + i));
+		memcpy(d + i, &m, w);
+	}
+	for (; i < n; i++)
+		d[i] = mean(mean(x[i], z[i]), y[i]);
+}
@@ -0,0 +1,8 @@
+/* pixel kernels */
+void blit_blend(void *dst, void *src, unsigned char *alpha, int n, unsigned fbm);
+void blit_row(void *dst, int cols, int c, void *src, int n, int bpp);
+void blit_magnify(void *dst, void *src, int n, int mag, int bpp);
+void blit_rotate(void *dst, int dll, void *src, int sll,
+		int rn, int cn, int rot, int bpp);
+int blit_diff(void *a, void *b, int n, int *beg, int *end);
+void blit_deint(void *dst, void *a, void *b, void *c, int n);
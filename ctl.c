@@ -0,0 +1,192 @@
+/*
+ * control socket
+ *
+ * Clients connect to a unix socket and send commands, one per line.
+ * The sockets are never waited on here: ctl_poll() adds them to the
+ * poll() of the player and ctl_line() reads only sockets that are
+ * ready, returning the buffered lines one by one.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ctl.h"
+
+#define CTLBUF		1024	/* client input buffer */
+
+struct conn {
+	int fd;			/* client socket; -1 if unused */
+	int eof;		/* the client has stopped sending */
+	int len;		/* buffered bytes */
+	char buf[CTLBUF];	/* received bytes */
+};
+
+static int ctl_fd = -1;		/* the listening socket */
+static char ctl_path[108];	/* socket path */
+static struct conn conns[CTL_CONNS];
+
+int ctl_open(char *path)
+{
+	struct sockaddr_un addr;
+	int i;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return 1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (ctl_fd < 0)
+		return 1;
+	unlink(path);
+	if (bind(ctl_fd, (void *) &addr, sizeof(addr)) < 0 || listen(ctl_fd, 4) < 0) {
+		close(ctl_fd);
+		ctl_fd = -1;
+		return 1;
+	}
+	strcpy(ctl_path, path);
+	for (i = 0; i < CTL_CONNS; i++)
+		conns[i].fd = -1;
+	return 0;
+}
+
+static void conn_close(struct conn *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+	c->eof = 0;
+}
+
+void ctl_close(void)
+{
+	int i;
+	if (ctl_fd < 0)
+		return;
+	for (i = 0; i < CTL_CONNS; i++)
+		if (conns[i].fd >= 0)
+			conn_close(&conns[i]);
+	close(ctl_fd);
+	unlink(ctl_path);
+	ctl_fd = -1;
+}
+
+/* fill fds with the sockets to wait for; returns their number */
+int ctl_poll(struct pollfd *fds, int n)
+{
+	int i, k = 0;
+	if (ctl_fd < 0 || n <= 0)
+		return 0;
+	fds[k].fd = ctl_fd;
+	fds[k++].events = POLLIN;
+	for (i = 0; i < CTL_CONNS && k < n; i++) {
+		if (conns[i].fd >= 0 && !conns[i].eof) {
+			fds[k].fd = conns[i].fd;
+			fds[k++].events = POLLIN;
+		}
+	}
+	return k;
+}
+
+/* accept new clients and read from ready ones */
+static void ctl_recv(void)
+{
+	struct pollfd fds[CTL_CONNS + 1];
+	int n = ctl_poll(fds, CTL_CONNS + 1);
+	int i, j, fd;
+	if (poll(fds, n, 0) <= 0)
+		return;
+	for (i = 0; i < CTL_CONNS; i++) {
+		struct conn *c = &conns[i];
+		if (c->fd < 0 || c->eof)
+			continue;
+		for (j = 1; j < n && fds[j].fd != c->fd; j++)
+			;
+		if (j == n || !fds[j].revents)
+			continue;
+		if (c->len == CTLBUF)	/* too long a line */
+			c->len = 0;
+		j = recv(c->fd, c->buf + c->len, CTLBUF - c->len, MSG_DONTWAIT);
+		if (j > 0)
+			c->len += j;
+		if (j == 0 || (j < 0 && errno != EAGAIN && errno != EINTR))
+			c->eof = 1;
+	}
+	if (fds[0].revents & POLLIN) {
+		while ((fd = accept(ctl_fd, NULL, NULL)) >= 0) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			for (i = 0; i < CTL_CONNS && conns[i].fd >= 0; i++)
+				;
+			if (i == CTL_CONNS) {
+				close(fd);
+				continue;
+			}
+			conns[i].fd = fd;
+		}
+	}
+}
+
+/* take a complete line of a client; returns the client or -1 */
+static int ctl_take(char *line, int len)
+{
+	int i;
+	for (i = 0; i < CTL_CONNS; i++) {
+		struct conn *c = &conns[i];
+		char *nl;
+		int n, m;
+		if (c->fd < 0)
+			continue;
+		nl = memchr(c->buf, '\n', c->len);
+		/* the last line of a client may lack a newline */
+		if (!nl && c->eof && c->len > 0 && c->len < CTLBUF)
+			nl = c->buf + c->len;
+		if (!nl) {
+			if (c->eof)
+				conn_close(c);
+			continue;
+		}
+		n = nl - c->buf;
+		snprintf(line, len, "%.*s", n, c->buf);
+		if (n > 0 && line[n - 1] == '\r' && n < len)
+			line[n - 1] = '\0';
+		m = n < c->len ? n + 1 : n;
+		memmove(c->buf, c->buf + m, c->len - m);
+		c->len -= m;
+		return i;
+	}
+	return -1;
+}
+
+/* read the next command; returns the client to answer or -1 if none */
+int ctl_line(char *line, int len)
+{
+	int cli;
+	if (ctl_fd < 0)
+		return -1;
+	if ((cli = ctl_take(line, len)) >= 0)
+		return cli;
+	ctl_recv();
+	return ctl_take(line, len);
+}
+
+void ctl_reply(int cli, char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+	int n;
+	if (conns[cli].fd < 0)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (n >= (int) sizeof(buf))
+		n = sizeof(buf) - 1;
+	send(conns[cli].fd, buf, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
@@ -0,0 +1,8 @@
+/* control socket */
+#define CTL_CONNS	8	/* maximum number of clients */
+
+int ctl_open(char *path);
+void ctl_close(void);
+int ctl_poll(struct pollfd *fds, int n);
+int ctl_line(char *line, int len);
+void ctl_reply(int cli, char *fmt, ...);
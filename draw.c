@@ -133,6 +133,11 @@ int fb_cols(void)
 	return xres ? xres : vinfo.xres;
 }
 
+int fb_linelen(void)
+{
+	return finfo.line_length;
+}
+
 void *fb_mem(int r)
 {
 	return fb + (r + vinfo.yoffset + yoff) * finfo.line_length + (vinfo.xoffset + xoff) * bpp;
@@ -11,6 +11,7 @@ int fb_init(char *dev);
 void fb_free(void);
 unsigned fb_mode(void);
 void *fb_mem(int r);
+int fb_linelen(void);
 int fb_rows(void);
 int fb_cols(void);
 void fb_cmap(void);
@@ -16,14 +16,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/soundcard.h>
 #include <pthread.h>
+#include <malloc.h>
+#include <sys/resource.h>
 #include "ffs.h"
+#include "fio.h"
 #include "draw.h"
+#include "sub.h"
+#include "thumb.h"
+#include "ovl.h"
+#include "blit.h"
+#include "perf.h"
+#include "ctl.h"
+#include "ring.h"
 
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
+#define LEN(a)		(sizeof(a) / sizeof((a)[0]))
+#define IOBUFMAX	1024	/* the largest readahead buffer (MiB) */
 
 static int paused;
 static int exited;
@@ -41,13 +54,42 @@ static int audio = 1;		/* audio stream; 0:none, 1:auto, >1:idx */
 static int posx, posy;		/* video position */
 static int rjust, bjust;	/* justify video to screen right/bottom */
 static int nodraw;		/* stop drawing */
+static int rotate;		/* screen rotation in degrees (clockwise) */
+static int dmg;			/* draw only the changed parts of frames */
+static int dmg_reset;		/* the screen was overwritten; redraw whole frames */
+static int faststart;		/* minimize the time to the first frame */
+static int startpos;		/* start position in seconds */
+static int iomode;		/* custom input mode (FIO_*) */
+static int iobuf = 8 << 20;	/* readahead buffer size */
+static int vsel, asel;		/* requested video and audio streams */
+static int mos_cols, mos_rows;	/* mosaic tile columns and rows */
+static int mos_audio;		/* the tile whose audio is played */
+static int mos_nowait;		/* do not wait for frame times */
+static int sheet_cols, sheet_rows;	/* contact sheet tiles */
+static char *sheet_ppm;		/* write the contact sheet to this file */
+static long membudget;		/* memory budget in bytes */
+static char *ctl_path;		/* control socket */
+static int powersave;		/* decode in bursts and sleep longer */
+static int aflags = FFS_ALTS;	/* ffs_alloc() flags of audio streams */
+static long play_ts;		/* when playback started */
+static long pause_beg;		/* when playback was paused */
+static long pause_ms;		/* the total pause time */
 static char *ossdsp;		/* OSS device */
+static char *perf_path;		/* write performance counters to this file */
+static int perf_req;		/* write performance counters now */
+static long perf_ts;		/* the last time the counters were written */
+static char *trace_path;	/* write a trace to this file */
+
+#define PERF_PERIOD	10000	/* performance counters write period (ms) */
+#define TRACE_LEN	(1 << 16)	/* trace spans kept per thread */
 
 static struct ffs *affs;	/* audio ffmpeg stream */
 static struct ffs *vffs;	/* video ffmpeg stream */
 static int afd;			/* oss fd */
+static int arate;		/* oss sample rate */
 static int vnum;		/* decoded video frame count */
 static long mark[256];		/* marks */
+static long loop_beg, loop_end;	/* A-B loop positions (ms) */
 
 static int sync_diff;		/* audio/video frame position diff */
 static int sync_period;		/* sync after every this many number of frames */
@@ -56,6 +98,24 @@ static int sync_cnt = 32;	/* synchronization steps */
 static int sync_cur;		/* synchronization steps left */
 static int sync_first;		/* first frame to record sync_diff */
 
+static long start_ts;		/* startup timestamp */
+
+static long ts_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* report the time of startup phases in fast-start mode */
+static void start_log(char *phase)
+{
+	if (faststart) {
+		fprintf(stderr, "fbff: %-12s %5ldms\n", phase, ts_ms() - start_ts);
+		dmg_reset = 1;
+	}
+}
+
 static void stroll(void)
 {
 	usleep(10000);
@@ -63,45 +123,162 @@ static void stroll(void)
 
 static void draw_row(int rb, int cb, void *img, int cn)
 {
-	int bpp = FBM_BPP(fb_mode());
 	if (rb < 0 || rb >= fb_rows())
 		return;
+	blit_row(fb_mem(rb), fb_cols(), cb, img, cn, FBM_BPP(fb_mode()));
+}
+
+/* screen rows and columns, as seen by the viewer */
+static int scr_rows(void)
+{
+	return rotate == 90 || rotate == 270 ? fb_cols() : fb_rows();
+}
+
+static int scr_cols(void)
+{
+	return rotate == 90 || rotate == 270 ? fb_rows() : fb_cols();
+}
+
+/* draw a rotated image at row rb and column cb of the viewer's screen */
+static void draw_rot(int rb, int cb, char *img, int linelen, int rn, int cn)
+{
+	int bpp = FBM_BPP(fb_mode());
+	int y, x;
+	if (rb < 0) {
+		img += -rb * linelen;
+		rn += rb;
+		rb = 0;
+	}
 	if (cb < 0) {
-		cn = -cb < cn ? cn + cb : 0;
-		img += -cb;
+		img += -cb * bpp;
+		cn += cb;
 		cb = 0;
 	}
-	if (cb + cn >= fb_cols())
-		cn = cb < fb_cols() ? fb_cols() - cb : 0;
-	memcpy(fb_mem(rb) + cb * bpp, img, cn * bpp);
+	rn = MIN(rn, scr_rows() - rb);
+	cn = MIN(cn, scr_cols() - cb);
+	if (rn <= 0 || cn <= 0)
+		return;
+	if (rotate == 90) {
+		y = cb;
+		x = fb_cols() - rb - rn;
+	} else if (rotate == 180) {
+		y = fb_rows() - rb - rn;
+		x = fb_cols() - cb - cn;
+	} else {
+		y = fb_rows() - cb - cn;
+		x = rb;
+	}
+	blit_rotate(fb_mem(y) + x * bpp, fb_linelen(),
+		img, linelen, rn, cn, rotate, bpp);
+}
+
+/* damage tracking: the previous frame and the changed parts of the new one */
+static char *dmg_prev;		/* the previous frame */
+static int *dmg_span;		/* the changed bytes of each row (beg, end) */
+static int dmg_rn, dmg_len;	/* rows and bytes per row of dmg_prev */
+static int dmg_rb, dmg_cb;	/* the position of dmg_prev */
+static long dmg_all, dmg_out;	/* bytes of the frames and bytes written */
+
+/* find the changed bytes of each row of img; returns the number of changed rows */
+static int dmg_scan(char *img, int linelen, int rn, int len, int rb, int cb, int bpp)
+{
+	int r, n = 0;
+	if (dmg_reset || rn != dmg_rn || len != dmg_len || rb != dmg_rb || cb != dmg_cb) {
+		free(dmg_prev);
+		free(dmg_span);
+		dmg_prev = malloc(rn * len);
+		dmg_span = malloc(rn * 2 * sizeof(dmg_span[0]));
+		dmg_rn = rn;
+		dmg_len = len;
+		dmg_rb = rb;
+		dmg_cb = cb;
+		dmg_reset = 0;
+		for (r = 0; r < rn; r++) {
+			memcpy(dmg_prev + r * len, img + r * linelen, len);
+			dmg_span[r * 2] = 0;
+			dmg_span[r * 2 + 1] = len;
+		}
+		return rn;
+	}
+	for (r = 0; r < rn; r++) {
+		char *prev = dmg_prev + r * len;
+		int beg = 0, end = 0;
+		if (blit_diff(prev, img + r * linelen, len, &beg, &end)) {
+			beg -= beg % bpp;
+			end += (bpp - end % bpp) % bpp;
+			memcpy(prev + beg, img + r * linelen + beg, end - beg);
+			n++;
+		}
+		dmg_span[r * 2] = beg;
+		dmg_span[r * 2 + 1] = end;
+	}
+	return n;
 }
 
 static void draw_frame(void *img, int linelen)
 {
 	int w, h, rn, cn, cb, rb;
-	int i, r, c, k;
+	int i, r;
 	int bpp = FBM_BPP(fb_mode());
+	int r0 = 0, r1;
 	if (nodraw)
 		return;
 	ffs_vinfo(vffs, &w, &h);
 	rn = h * zoom;
 	cn = w * zoom;
-	cb = rjust ? fb_cols() - cn * magnify + posx : posx;
-	rb = bjust ? fb_rows() - rn * magnify + posy : posy;
-	if (magnify == 1) {
-		for (r = 0; r < rn; r++)
-			draw_row(rb + r, cb, img + r * linelen, cn);
+	cb = rjust ? scr_cols() - cn * magnify + posx : posx;
+	rb = bjust ? scr_rows() - rn * magnify + posy : posy;
+	r1 = rn;
+	if (rn <= 0 || cn <= 0)
+		return;
+	if (dmg) {
+		dmg_all += (long) rn * cn * bpp * magnify * magnify;
+		if (!dmg_scan(img, linelen, rn, cn * bpp, rb, cb, bpp))
+			return;
+		while (dmg_span[r0 * 2] == dmg_span[r0 * 2 + 1])
+			r0++;
+		while (dmg_span[r1 * 2 - 2] == dmg_span[r1 * 2 - 1])
+			r1--;
+	}
+	if (rotate && magnify == 1) {
+		draw_rot(rb + r0, cb, img + r0 * linelen, linelen, r1 - r0, cn);
+		dmg_out += (long) (r1 - r0) * cn * bpp;
+	} else if (magnify == 1) {
+		for (r = r0; r < r1; r++) {
+			int beg = dmg ? dmg_span[r * 2] : 0;
+			int end = dmg ? dmg_span[r * 2 + 1] : cn * bpp;
+			if (beg == end)
+				continue;
+			draw_row(rb + r, cb + beg / bpp, img + r * linelen + beg,
+				(end - beg) / bpp);
+			dmg_out += end - beg;
+		}
+	} else if (rotate) {
+		int blen = cn * magnify * bpp;
+		char *mimg = malloc((r1 - r0) * magnify * blen);
+		for (r = r0; r < r1; r++) {
+			blit_magnify(mimg + (r - r0) * magnify * blen,
+				img + r * linelen, cn, magnify, bpp);
+			for (i = 1; i < magnify; i++)
+				memcpy(mimg + ((r - r0) * magnify + i) * blen,
+					mimg + (r - r0) * magnify * blen, blen);
+		}
+		draw_rot(rb + r0 * magnify, cb, mimg, blen,
+			(r1 - r0) * magnify, cn * magnify);
+		dmg_out += (long) (r1 - r0) * magnify * blen;
+		free(mimg);
 	} else {
 		char *brow = malloc(cn * magnify * bpp);
-		for (r = 0; r < rn; r++) {
-			char *src = img + r * linelen;
-			char *dst = brow;
-			for (c = 0; c < cn; c++)
-				for (i = 0; i < magnify; i++)
-					for (k = 0; k < bpp; k++)
-						*dst++ = src[c * bpp + k];
+		for (r = r0; r < r1; r++) {
+			int beg = dmg ? dmg_span[r * 2] : 0;
+			int end = dmg ? dmg_span[r * 2 + 1] : cn * bpp;
+			if (beg == end)
+				continue;
+			blit_magnify(brow, img + r * linelen, cn, magnify, bpp);
 			for (i = 0; i < magnify; i++)
-				draw_row((rb + r) * magnify + i, cb, brow, cn * magnify);
+				draw_row((rb + r) * magnify + i, cb + beg / bpp * magnify,
+					brow + beg * magnify, (end - beg) / bpp * magnify);
+			dmg_out += (end - beg) * magnify * magnify;
 		}
 		free(brow);
 	}
@@ -111,10 +288,15 @@ static int oss_open(void)
 {
 	int rate, ch, bps;
 	int frag = 0x0003000b;	/* 0xmmmmssss: 2^m fragments of size 2^s each */
+	if (powersave)
+		frag = 0x0004000d;
 	afd = open(ossdsp, O_WRONLY);
 	if (afd < 0)
 		return errno;
 	ffs_ainfo(affs, &rate, &bps, &ch);
+	if (arate)
+		rate = arate;
+	arate = rate;
 	ioctl(afd, SOUND_PCM_WRITE_CHANNELS, &ch);
 	ioctl(afd, SOUND_PCM_WRITE_BITS, &bps);
 	ioctl(afd, SOUND_PCM_WRITE_RATE, &rate);
@@ -131,81 +313,109 @@ static void oss_close(void)
 
 /* audio buffers */
 
-#define ABUFCNT		(1 << 3)	/* number of audio buffers */
-#define ABUFLEN		(1 << 18)	/* audio buffer length */
-
-static int a_cons;
-static int a_prod;
-static char a_buf[ABUFCNT][ABUFLEN];
-static int a_len[ABUFCNT];
+static int a_blen = RING_LEN;	/* the length of ring buffers */
+static int a_fill;		/* the filled bytes of ring_head() */
 static int a_reset;
+static int a_wake[2] = {-1, -1};	/* the audio thread wakes the main thread (-E) */
+
+#define A_BURST		150	/* -E: milliseconds of audio per buffer */
+#define A_BURSTS	2	/* -E: the number of buffers queued */
+
+/* bytes of ms milliseconds of audio */
+static long a_bytes(long ms)
+{
+	int rate, bps, ch;
+	ffs_ainfo(affs, &rate, &bps, &ch);
+	return (arate ? arate : rate) * ch * bps / 8 * ms / 1000;
+}
+
+/* milliseconds of decoded audio not yet played */
+static int a_lag(void)
+{
+	int delay = 0;
+	if (afd <= 0 || ioctl(afd, SNDCTL_DSP_GETODELAY, &delay) < 0)
+		delay = 0;
+	return (long) (a_fill + ring_bytes() + delay) * 1000 / MAX(1, a_bytes(1000));
+}
 
-static int a_conswait(void)
+/* audio/video offset, as heard and seen */
+static int avdiff(void)
 {
-	return a_cons == a_prod;
+	return ffs_avdiff(vffs, affs) - a_lag();
 }
 
-static int a_prodwait(void)
+/* return nonzero if more audio can be decoded */
+static int a_room(void)
 {
-	return ((a_prod + 1) & (ABUFCNT - 1)) == a_cons;
+	return !ring_full() && (!powersave || ring_used() < A_BURSTS);
 }
 
 static void a_doreset(int pause)
 {
+	long t = perf_now();
+	ring_lock();
 	a_reset = 1 + pause;
+	ring_wake();
 	while (audio && a_reset)
-		stroll();
+		ring_wait();
+	ring_unlock();
+	if (!pause) {
+		a_fill = 0;
+		perf_span(PERF_RESET, t);
+	}
 }
 
-/* subtitle handling */
-
-#define SUBSCNT		2048		/* number of subtitles */
-#define SUBSLEN		80		/* maximum subtitle length */
-
-static char *sub_path;			/* subtitles file */
-static char sub_text[SUBSCNT][SUBSLEN];	/* subtitle text */
-static long sub_beg[SUBSCNT];		/* printing position */
-static long sub_end[SUBSCNT];		/* hiding position */
-static int sub_n;			/* subtitle count */
-static int sub_last;			/* last printed subtitle */
-
-static void sub_read(void)
+/* decode audio into ring_head(); returns nonzero at the end of the stream */
+static int a_decode(void)
 {
-	struct ffs *sffs = ffs_alloc(sub_path, FFS_SUBTS);
-	if (!sffs)
-		return;
-	while (sub_n < SUBSCNT && !ffs_sdec(sffs, sub_text[sub_n], SUBSLEN,
-			&sub_beg[sub_n], &sub_end[sub_n])) {
-		sub_n++;
+	int ret = ffs_adec(affs, ring_head() + a_fill, a_blen - a_fill);
+	if (ret > 0)
+		a_fill += ret;
+	/* in power saving mode, buffers are filled with several frames */
+	if (a_fill && (ret < 0 || !powersave || a_fill >= a_bytes(A_BURST) ||
+			a_blen - a_fill < RING_MIN)) {
+		ring_put(a_fill);
+		a_fill = 0;
 	}
-	ffs_free(sffs);
+	return ret < 0;
 }
 
+/* subtitle handling */
+
+static char *sub_path;			/* subtitles file */
+static struct sub *sub_last[16];	/* last shown subtitles */
+static int sub_nlast;			/* number of shown subtitles */
+static int sub_font;			/* text subtitles are drawn on the video */
+
 static void sub_print(void)
 {
 	struct ffs *ffs = video ? vffs : affs;
-	int l = 0;
-	int h = sub_n;
-	long pos = ffs_pos(ffs);
-	while (l < h) {
-		int m = (l + h) >> 1;
-		if (pos >= sub_beg[m] && pos <= sub_end[m]) {
-			if (sub_last != m)
-				printf("\r\33[K%s", sub_text[m]);
-			sub_last = m;
-			fflush(stdout);
-			return;
-		}
-		if (pos < sub_beg[m])
-			h = m;
-		else
-			l = m + 1;
+	struct sub *subs[LEN(sub_last)];
+	int n, i;
+	if (!sub_path)
+		return;
+	n = sub_find(ffs_pos(ffs), subs, LEN(subs));
+	if (n == sub_nlast && !memcmp(subs, sub_last, n * sizeof(subs[0])))
+		return;
+	memcpy(sub_last, subs, n * sizeof(subs[0]));
+	sub_nlast = n;
+	if (video) {
+		int w, h;
+		ffs_vinfo(vffs, &w, &h);
+		ovl_make(subs, n, w * zoom, h * zoom, zoom);
 	}
-	if (sub_last >= 0) {
-		printf("\r\33[K");
-		fflush(stdout);
-		sub_last = -1;
+	if (video && sub_font)
+		return;
+	dmg_reset = 1;
+	printf("\r\33[K");
+	for (i = 0; i < n; i++) {
+		char *s = subs[i]->text;
+		if (i && s)
+			printf(" / ");
+		for (; s && *s; s++)
+			putchar(*s == '\n' ? ' ' : *s);
 	}
+	fflush(stdout);
 }
 
 /* fbff commands */
@@ -220,10 +430,28 @@ static int cmdread(void)
 
 static void cmdwait(void)
 {
-	struct pollfd ufds[1];
+	struct pollfd ufds[CTL_CONNS + 2];
+	int n = 1;
+	ufds[0].fd = 0;
+	ufds[0].events = POLLIN;
+	n += ctl_poll(ufds + 1, LEN(ufds) - 1);
+	poll(ufds, n, -1);
+}
+
+/* sleep up to ms milliseconds (-1 for no limit) for a command or a free audio buffer */
+static void cmdidle(int ms)
+{
+	struct pollfd ufds[CTL_CONNS + 2];
+	char b[64];
+	int n = 2;
 	ufds[0].fd = 0;
 	ufds[0].events = POLLIN;
-	poll(ufds, 1, -1);
+	ufds[1].fd = a_wake[0];
+	ufds[1].events = POLLIN;
+	n += ctl_poll(ufds + 2, LEN(ufds) - 2);
+	poll(ufds, n, ms);
+	while (read(a_wake[0], b, sizeof(b)) > 0)
+		;
 }
 
 static void cmdjmp(int n, int rel)
@@ -247,15 +475,69 @@ static void cmdinfo(void)
 	struct ffs *ffs = video ? vffs : affs;
 	long pos = ffs_pos(ffs);
 	long percent = ffs_duration(ffs) ? pos * 10 / (ffs_duration(ffs) / 100) : 0;
-	printf("\r\33[K%c %3ld.%01ld%%  %3ld:%02ld.%01ld  (AV:%4d)     [%s] \r",
+	long nread, nstall;
+	int fill;
+	dmg_reset = 1;
+	printf("\r\33[K%c %3ld.%01ld%%  %3ld:%02ld.%01ld  (AV:%4d)     [%s] ",
 		paused ? (afd < 0 ? '*' : ' ') : '>',
 		percent / 10, percent % 10,
 		pos / 60000, (pos % 60000) / 1000, (pos % 1000) / 100,
-		video && audio ? ffs_avdiff(vffs, affs) : 0,
+		video && audio ? avdiff() : 0,
 		filename);
+	if (!ffs_iostat(ffs, &nread, &nstall, &fill))
+		printf("(IO:%ldM %ld %d%%) ", nread >> 20, nstall, fill);
+	if (dmg && dmg_all)
+		printf("(DMG:%ld%%) ", 100 - dmg_out * 100 / dmg_all);
+	printf("(dmx %ld dec %ld scl %ld drw %ld aw %ld us, drop %ld late %ld xrun %ld) ",
+		perf_mean(PERF_DEMUX), perf_mean(PERF_VDEC), perf_mean(PERF_SCALE),
+		perf_mean(PERF_DRAW), perf_mean(PERF_AWRITE), perf_events(PERF_DROP),
+		perf_events(PERF_LATE), perf_events(PERF_XRUN));
+	printf("\r");
 	fflush(stdout);
 }
 
+/* write performance counters to perf_path; renamed for atomic updates */
+static void perf_save(void)
+{
+	struct ffs *ffs = video ? vffs : affs;
+	char tmp[1024];
+	long nread, nstall;
+	int fill;
+	FILE *fp;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", perf_path);
+	if (!(fp = fopen(tmp, "w")))
+		return;
+	fprintf(fp, "file %s\n", filename);
+	if (ffs)
+		fprintf(fp, "pos %ld\n", ffs_pos(ffs));
+	perf_write(fp);
+	if (ffs && !ffs_iostat(ffs, &nread, &nstall, &fill)) {
+		fprintf(fp, "io.read %ld\n", nread);
+		fprintf(fp, "io.stall %ld\n", nstall);
+		fprintf(fp, "io.fill %d\n", fill);
+	}
+	fclose(fp);
+	rename(tmp, perf_path);
+	perf_ts = ts_ms();
+	perf_req = 0;
+}
+
+/* write the trace at exit, whichever mode fbff was in */
+static void trace_save(void)
+{
+	if (perf_tracesave(trace_path))
+		fprintf(stderr, "fbff: cannot write %s\n", trace_path);
+}
+
+/* loop between loop_beg and loop_end; stop looping if loop_end is zero */
+static void cmdloop(void)
+{
+	if (audio)
+		ffs_loop(affs, loop_beg, loop_end);
+	if (video)
+		ffs_loop(vffs, loop_beg, loop_end);
+}
+
 static int cmdarg(int def)
 {
 	int n = arg;
@@ -263,91 +545,290 @@ static int cmdarg(int def)
 	return n ? n : def;
 }
 
-static void cmdexec(void)
+/* switch to audio stream n of the current file; the next one if n is negative */
+static int cmdaudio(int n)
 {
-	int c;
-	while ((c = cmdread()) >= 0) {
-		if (domark) {
-			domark = 0;
-			mark[c] = ffs_pos(video ? vffs : affs);
-			continue;
-		}
-		if (dojump) {
-			dojump = 0;
-			if (mark[c] > 0)
-				cmdjmp(mark[c] / 1000, 0);
-			continue;
-		}
-		switch (c) {
-		case 'q':
-			exited = 1;
-			break;
-		case 'l':
-			cmdjmp(cmdarg(1) * 10, 1);
-			break;
-		case 'h':
-			cmdjmp(-cmdarg(1) * 10, 1);
-			break;
-		case 'j':
-			cmdjmp(cmdarg(1) * 60, 1);
-			break;
-		case 'k':
-			cmdjmp(-cmdarg(1) * 60, 1);
-			break;
-		case 'J':
-			cmdjmp(cmdarg(1) * 600, 1);
-			break;
-		case 'K':
-			cmdjmp(-cmdarg(1) * 600, 1);
-			break;
-		case 'G':
-			cmdjmp(cmdarg(0) * 60, 0);
-			break;
-		case '%':
-			cmdjmp(cmdarg(0) * ffs_duration(vffs ? vffs : affs) / 100000, 0);
-			break;
-		case 'm':
-			domark = 1;
-			break;
-		case '\'':
-			dojump = 1;
-			break;
-		case 'i':
-			cmdinfo();
-			break;
-		case ' ':
-		case 'p':
-			if (audio && paused)
-				if (oss_open())
-					break;
-			if (audio && !paused)
-				oss_close();
-			paused = !paused;
-			sync_cur = sync_cnt;
-			break;
-		case '-':
-			sync_diff = -cmdarg(0);
-			break;
-		case '+':
-			sync_diff = cmdarg(0);
-			break;
-		case 'a':
-			sync_diff = ffs_avdiff(vffs, affs);
-			break;
-		case 'c':
-			sync_cnt = cmdarg(0);
-			break;
-		case 's':
-			sync_cur = cmdarg(sync_cnt);
-			break;
-		case 27:
-			arg = 0;
-			break;
-		default:
-			if (isdigit(c))
-				arg = arg * 10 + c - '0';
-		}
+	int si;
+	if (!audio || (si = ffs_aswitch(affs, n)) < 0)
+		return 1;
+	a_doreset(0);		/* drop the queued audio of the old stream */
+	sync_cur = sync_cnt;
+	asel = si + 2;
+	audio = asel;
+	return 0;
+}
+
+static void cmdpause(void)
+{
+	if (audio && paused)
+		if (oss_open())
+			return;
+	if (audio && !paused)
+		oss_close();
+	paused = !paused;
+	sync_cur = sync_cnt;
+	if (paused)
+		pause_beg = ts_ms();
+	else
+		pause_ms += ts_ms() - pause_beg;
+	ring_signal();
+}
+
+static void cmdkey(int c)
+{
+	if (domark) {
+		domark = 0;
+		mark[c] = ffs_pos(video ? vffs : affs);
+		return;
+	}
+	if (dojump) {
+		dojump = 0;
+		if (mark[c] > 0)
+			cmdjmp(mark[c] / 1000, 0);
+		return;
+	}
+	switch (c) {
+	case 'q':
+		exited = 1;
+		break;
+	case 'l':
+		cmdjmp(cmdarg(1) * 10, 1);
+		break;
+	case 'h':
+		cmdjmp(-cmdarg(1) * 10, 1);
+		break;
+	case 'j':
+		cmdjmp(cmdarg(1) * 60, 1);
+		break;
+	case 'k':
+		cmdjmp(-cmdarg(1) * 60, 1);
+		break;
+	case 'J':
+		cmdjmp(cmdarg(1) * 600, 1);
+		break;
+	case 'K':
+		cmdjmp(-cmdarg(1) * 600, 1);
+		break;
+	case 'G':
+		cmdjmp(cmdarg(0) * 60, 0);
+		break;
+	case '%':
+		cmdjmp(cmdarg(0) * ffs_duration(vffs ? vffs : affs) / 100000, 0);
+		break;
+	case 'm':
+		domark = 1;
+		break;
+	case '\'':
+		dojump = 1;
+		break;
+	case 'i':
+		cmdinfo();
+		break;
+	case '[':
+		loop_beg = ffs_pos(video ? vffs : affs);
+		break;
+	case ']':
+		loop_end = ffs_pos(video ? vffs : affs);
+		cmdloop();
+		break;
+	case '\\':
+		loop_end = 0;
+		cmdloop();
+		break;
+	case ' ':
+	case 'p':
+		cmdpause();
+		break;
+	case 'A':
+		cmdaudio(-1);
+		break;
+	case '-':
+		sync_diff = -cmdarg(0);
+		break;
+	case '+':
+		sync_diff = cmdarg(0);
+		break;
+	case 'a':
+		sync_diff = avdiff();
+		break;
+	case 'c':
+		sync_cnt = cmdarg(0);
+		break;
+	case 's':
+		sync_cur = cmdarg(sync_cnt);
+		break;
+	case 27:
+		arg = 0;
+		break;
+	default:
+		if (isdigit(c))
+			arg = arg * 10 + c - '0';
+	}
+}
+
+/* playlist */
+
+struct item {
+	int idx;		/* playlist index */
+	struct ffs *vffs;	/* video stream */
+	struct ffs *affs;	/* audio stream */
+	float zoom;		/* video zoom */
+	void *frame;		/* the first video frame */
+	int linelen;		/* frame line length */
+};
+
+static char **plist;		/* playlist files */
+static int plist_n;		/* number of files */
+static int plist_sz;		/* allocated plist entries */
+static int plist_cur;		/* the current file */
+static int plist_loop;		/* loop the playlist */
+
+#define PLIST_MEMMIN	(64 << 20)	/* the smallest budget for preloading */
+static struct item next;	/* the next item */
+static pthread_t next_thread;	/* the thread opening the next item */
+static int next_busy;		/* next_thread is running */
+static int fb_on;		/* the framebuffer is initialized */
+static int next_lazy;		/* open the next item when switching to it */
+
+static void plist_add(char *path)
+{
+	if (plist_n == plist_sz) {
+		plist_sz = plist_sz ? plist_sz * 2 : 16;
+		plist = realloc(plist, plist_sz * sizeof(plist[0]));
+	}
+	plist[plist_n++] = path;
+}
+
+static void plist_read(char *path)
+{
+	char line[1024];
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (strchr(line, '\n'))
+			*strchr(line, '\n') = '\0';
+		if (line[0] && line[0] != '#')
+			plist_add(strdup(line));
+	}
+	fclose(fp);
+}
+
+/* the zoom of the video of ffs */
+static float item_zoom(struct ffs *ffs)
+{
+	int w, h;
+	float hz, wz;
+	if (!fullscreen)
+		return zoom;
+	ffs_vinfo(ffs, &w, &h);
+	hz = (float) scr_rows() / h / magnify;
+	wz = (float) scr_cols() / w / magnify;
+	return hz < wz ? hz : wz;
+}
+
+/* open the streams of an item and decode its first video frame */
+static void *item_load(void *dat)
+{
+	struct item *it = dat;
+	char *path = plist[it->idx];
+	int flags = faststart ? FFS_FAST : 0;
+	if (vsel && fb_on && (it->vffs = ffs_alloc(path, FFS_VIDEO | (vsel - 1) | flags))) {
+		it->zoom = item_zoom(it->vffs);
+		ffs_vconf(it->vffs, it->zoom, fb_mode());
+		it->linelen = ffs_vdec(it->vffs, &it->frame);
+	}
+	if (asel && arate && (it->affs = ffs_alloc(path, FFS_AUDIO | aflags | (asel - 1) | flags)))
+		ffs_aconf(it->affs, arate);
+	return NULL;
+}
+
+static void item_free(struct item *it)
+{
+	if (it->vffs)
+		ffs_free(it->vffs);
+	if (it->affs)
+		ffs_free(it->affs);
+	memset(it, 0, sizeof(*it));
+}
+
+/* start opening the next item in the background */
+static void plist_load(int idx)
+{
+	if (idx >= plist_n && plist_loop)
+		idx = 0;
+	if (idx >= plist_n)
+		return;
+	memset(&next, 0, sizeof(next));
+	next.idx = idx;
+	if (membudget && membudget < PLIST_MEMMIN)
+		next_lazy = 1;
+	else if (!pthread_create(&next_thread, NULL, item_load, &next))
+		next_busy = 1;
+}
+
+static void plist_wait(void)
+{
+	if (next_busy)
+		pthread_join(next_thread, NULL);
+	next_busy = 0;
+}
+
+/* wait for the next item; if not preloaded, open it after closing the current one */
+static void plist_fetch(void)
+{
+	plist_wait();
+	if (next_lazy) {
+		if (vffs)
+			ffs_free(vffs);
+		if (affs)
+			ffs_free(affs);
+		vffs = NULL;
+		affs = NULL;
+		item_load(&next);
+		next_lazy = 0;
+	}
+}
+
+/* switch to the next item; return nonzero at the end of the playlist */
+static int plist_next(void)
+{
+	int tries = 0;
+	plist_fetch();
+	while (next.idx != plist_cur && !next.vffs && !next.affs && tries++ < plist_n) {
+		plist_load(next.idx + 1);
+		plist_fetch();
 	}
+	if (!next.vffs && !next.affs)
+		return 1;
+	if (vffs)
+		ffs_free(vffs);
+	if (affs)
+		ffs_free(affs);
+	vffs = next.vffs;
+	affs = next.affs;
+	next.vffs = NULL;
+	next.affs = NULL;
+	video = vffs ? vsel : 0;
+	audio = affs ? asel : 0;
+	zoom = vffs ? next.zoom : zoom;
+	plist_cur = next.idx;
+	snprintf(filename, sizeof(filename), "%s", plist[plist_cur]);
+	memset(mark, 0, sizeof(mark));
+	loop_end = 0;
+	vnum = 0;
+	sync_cur = sync_cnt;
+	if (sub_path) {
+		sub_free();
+		sub_path = NULL;
+		ovl_make(NULL, 0, 0, 0, zoom);
+	}
+	if (vffs && next.linelen > 0) {
+		draw_frame(next.frame, next.linelen);
+		vnum++;
+	}
+	plist_load(plist_cur + 1);
+	return 0;
 }
 
 /* return nonzero if one more video frame can be decoded */
@@ -361,77 +842,217 @@ static int vsync(void)
 		sync_cur = 0;
 		if (sync_first < vnum) {
 			sync_first = 0;
-			sync_diff = ffs_avdiff(vffs, affs);
+			sync_diff = avdiff();
 		}
 	}
 	if (sync_cur > 0) {
 		sync_cur--;
-		return ffs_avdiff(vffs, affs) >= sync_diff;
+		return avdiff() >= sync_diff;
 	}
 	ffs_wait(vffs);
 	return 1;
 }
 
+/* control socket commands */
+
+/* write s as a JSON string */
+static void ctlstr(char *d, int len, char *s)
+{
+	char *e = d + len - 3;
+	*d++ = '"';
+	for (; *s && d < e; s++) {
+		if (*s == '"' || *s == '\\')
+			*d++ = '\\';
+		*d++ = (unsigned char) *s < ' ' ? ' ' : *s;
+	}
+	*d++ = '"';
+	*d = '\0';
+}
+
+static void ctlstatus(int cli)
+{
+	struct ffs *ffs = video ? vffs : affs;
+	char file[512];
+	ctlstr(file, sizeof(file), plist[plist_cur]);
+	ctl_reply(cli, "{\"file\":%s,\"index\":%d,\"pos\":%ld,\"duration\":%ld,"
+		"\"paused\":%d,\"loop\":[%ld,%ld],\"avdiff\":%d,\"audio\":%d,"
+		"\"frames\":%d,\"drop\":%ld,\"late\":%ld,\"xrun\":%ld}\n",
+		file, plist_cur, ffs_pos(ffs), ffs_duration(ffs),
+		paused, loop_beg, loop_end,
+		video && audio ? avdiff() : 0,
+		audio ? ffs_sidx(affs) : -1,
+		vnum, perf_events(PERF_DROP), perf_events(PERF_LATE),
+		perf_events(PERF_XRUN));
+}
+
+/* execute a control command; returns nonzero on errors */
+static int ctlcmd(int cli, char *cmd)
+{
+	char name[16] = "";
+	char a1[64] = "";
+	char a2[64] = "";
+	while (isspace((unsigned char) *cmd))
+		cmd++;
+	sscanf(cmd, "%15s %63s %63s", name, a1, a2);
+	if (!name[0])
+		return 0;
+	if (!strcmp("status", name)) {
+		ctlstatus(cli);
+		return 0;
+	}
+	if (!strcmp("seek", name) && a1[0]) {
+		cmdjmp(atoi(a1), a1[0] == '+' || a1[0] == '-');
+	} else if (!strcmp("pause", name)) {
+		if (!paused)
+			cmdpause();
+	} else if (!strcmp("play", name)) {
+		if (paused)
+			cmdpause();
+	} else if (!strcmp("loop", name) && a1[0]) {
+		loop_beg = atoi(a1) * 1000;
+		loop_end = strcmp("off", a1) ? atoi(a2) * 1000 : 0;
+		cmdloop();
+	} else if (!strcmp("audio", name) && a1[0]) {
+		if (cmdaudio(atoi(a1)))
+			return 1;
+	} else if (!strcmp("keys", name)) {
+		char *s = strchr(cmd, ' ');
+		while (s && *++s)
+			cmdkey((unsigned char) *s);
+	} else if (!strcmp("quit", name)) {
+		exited = 1;
+	} else {
+		return 1;
+	}
+	ctl_reply(cli, "ok\n");
+	return 0;
+}
+
+/* execute the commands received on the control socket */
+static void ctlexec(void)
+{
+	char line[1024];
+	int cli;
+	while ((cli = ctl_line(line, sizeof(line))) >= 0) {
+		char *cmd = strtok(line, ";");
+		for (; cmd; cmd = strtok(NULL, ";"))
+			if (ctlcmd(cli, cmd))
+				ctl_reply(cli, "error %s\n", cmd);
+	}
+}
+
+static void cmdexec(void)
+{
+	int c;
+	while ((c = cmdread()) >= 0)
+		cmdkey(c);
+	ctlexec();
+}
+
 static void mainloop(void)
 {
-	int eof = 0;
-	while (eof < audio + video) {
+	int aeof = !audio;
+	int veof = !video;
+	int drawn = 0;
+	while (1) {
+		if (aeof && veof) {
+			if (plist_next())
+				break;
+			aeof = !audio;
+			veof = !video;
+		}
 		cmdexec();
 		if (exited)
 			break;
+		if (perf_path && (perf_req || ts_ms() - perf_ts >= PERF_PERIOD))
+			perf_save();
 		if (paused) {
 			a_doreset(1);
 			cmdwait();
 			continue;
 		}
-		while (audio && !eof && !a_prodwait()) {
-			int ret = ffs_adec(affs, a_buf[a_prod], ABUFLEN);
-			if (ret < 0)
-				eof++;
-			if (ret > 0) {
-				a_len[a_prod] = ret;
-				a_prod = (a_prod + 1) & (ABUFCNT - 1);
-			}
+		while (audio && !aeof && a_room())
+			aeof = a_decode();
+		/* in power saving mode, sleep until the next frame is due; ffs_wait() advances the clock */
+		if (powersave && video && !veof && audio && !aeof && ffs_due(vffs) > 0) {
+			cmdidle(ffs_due(vffs));
+			continue;
 		}
-		if (video && (!audio || eof || vsync())) {
+		if (video && !veof && (!audio || aeof || vsync())) {
 			int ignore = jump && (vnum % (jump + 1));
 			void *buf;
 			int ret = ffs_vdec(vffs, ignore ? NULL : &buf);
 			vnum++;
 			if (ret < 0)
-				eof++;
-			if (ret > 0)
-				draw_frame((void *) buf, ret);
+				veof = 1;
+			if (ret >= 0 && ignore)
+				perf_inc(PERF_DROP);
+			if (ret >= 0 && audio && !aeof)
+				perf_add(PERF_DRIFT, abs(avdiff()));
 			sub_print();
+			if (ret > 0) {
+				long t = perf_now();
+				ovl_draw(buf, ret);
+				draw_frame((void *) buf, ret);
+				perf_span(PERF_DRAW, t);
+				if (!drawn++)
+					start_log("first frame");
+			}
+		} else if (powersave && audio && !aeof) {
+			/* audio is decoded when the audio thread frees a buffer */
+			cmdidle(-1);
 		} else {
 			stroll();
 		}
 	}
 	exited = 1;
+	ring_signal();
 }
 
 static void *process_audio(void *dat)
 {
+	int played = 0;		/* the device has been written since the last reset */
 	while (1) {
-		while (!a_reset && (a_conswait() || paused) && !exited)
-			stroll();
-		if (exited)
-			return NULL;
+		ring_lock();
+		while (!a_reset && (ring_empty() || paused) && !exited)
+			ring_wait();
 		if (a_reset) {
 			if (a_reset == 1)
-				a_cons = a_prod;
+				ring_drop();
+			if (a_reset == 1 && afd > 0)
+				ioctl(afd, SNDCTL_DSP_RESET, NULL);
 			a_reset = 0;
+			played = 0;
+			ring_wake();
+			ring_unlock();
 			continue;
 		}
+		ring_unlock();
+		if (exited)
+			return NULL;
 		if (afd > 0) {
-			write(afd, a_buf[a_cons], a_len[a_cons]);
-			a_cons = (a_cons + 1) & (ABUFCNT - 1);
+			int delay = -1;
+			char *buf;
+			int len;
+			long t;
+			/* the device has played everything: an underrun */
+			if (played && !ioctl(afd, SNDCTL_DSP_GETODELAY, &delay) && !delay)
+				perf_inc(PERF_XRUN);
+			perf_add(PERF_RING, ring_used());
+			buf = ring_tail(&len);
+			t = perf_now();
+			write(afd, buf, len);
+			perf_span(PERF_AWRITE, t);
+			ring_take();
+			played = 1;
+			if (a_wake[1] >= 0)
+				write(a_wake[1], "", 1);
 		}
 	}
 	return NULL;
 }
 
-static char *usage = "usage: fbff [options] file\n"
+static char *usage = "usage: fbff [options] file...\n"
 	"\noptions:\n"
 	"  -z n     zoom the video\n"
 	"  -m n     magnify the video by duplicating pixels\n"
@@ -439,15 +1060,35 @@ static char *usage = "usage: fbff [options] file\n"
 	"  -f       start full screen\n"
 	"  -v n     select video stream; '-' disables video\n"
 	"  -a n     select audio stream; '-' disables audio\n"
+	"  -w       decode the other audio streams for gapless switching\n"
 	"  -s       always synchronize (-sx for every x frames)\n"
 	"  -u       record A/V delay after the first few frames\n"
 	"  -t path  subtitles file\n"
 	"  -x n     horizontal video position\n"
 	"  -y n     vertical video position\n"
 	"  -r       adjust the video to the right of the screen\n"
-	"  -b       adjust the video to the bottom of the screen\n\n";
+	"  -b       adjust the video to the bottom of the screen\n"
+	"  -d       draw only the changed parts of frames\n"
+	"  -S path  write performance counters to path periodically\n"
+	"  -T path  write a trace of decoding and drawing to path at exit\n"
+	"  -C path  accept commands on a unix socket\n"
+	"  -M n     limit memory use to about n MiB\n"
+	"  -E       save power; decode audio in bursts and sleep until needed\n"
+	"  -R n     rotate the screen clockwise by n (90, 180, or 270) degrees\n"
+	"  -F       fast start; limit probing and open devices in parallel\n"
+	"  -o n     start playing from second n\n"
+	"  -I m     read memory-mapped files\n"
+	"  -I rn    read ahead in a thread with an n MiB buffer\n"
+	"  -P path  read the files to play from path\n"
+	"  -L       loop the playlist\n"
+	"  -A a:b   loop between seconds a and b\n"
+	"  -g cxr   play the files in c columns and r rows of tiles\n"
+	"  -G n     play the audio of tile n in tiles mode\n"
+	"  -N       do not wait for frame times in tiles mode (benchmark)\n"
+	"  -c cxr   show a contact sheet of c columns and r rows\n"
+	"  -O path  write the contact sheet to a PPM file\n\n";
 
-static void read_args(int argc, char *argv[])
+static int read_args(int argc, char *argv[])
 {
 	int i = 1;
 	while (i < argc) {
@@ -478,6 +1119,59 @@ static void read_args(int argc, char *argv[])
 			bjust = 1;
 		if (c[1] == 'u')
 			sync_first = 32;
+		if (c[1] == 'F')
+			faststart = 1;
+		if (c[1] == 'd')
+			dmg = 1;
+		if (c[1] == 'S')
+			perf_path = c[2] ? c + 2 : argv[++i];
+		if (c[1] == 'C')
+			ctl_path = c[2] ? c + 2 : argv[++i];
+		if (c[1] == 'E')
+			powersave = 1;
+		if (c[1] == 'w')
+			aflags |= FFS_ALTDEC;
+		if (c[1] == 'M')
+			membudget = (c[2] ? atol(c + 2) : atol(argv[++i])) << 20;
+		if (c[1] == 'T')
+			trace_path = c[2] ? c + 2 : argv[++i];
+		if (c[1] == 'R')
+			rotate = ((c[2] ? atoi(c + 2) : atoi(argv[++i])) % 360 + 360) % 360;
+		if (c[1] == 'I') {
+			char *arg = c[2] ? c + 2 : argv[++i];
+			iomode = arg[0] == 'm' ? FIO_MMAP : FIO_AHEAD;
+			if (arg[0] == 'r' && isdigit((unsigned char) arg[1])) {
+				long mb = strtol(arg + 1, NULL, 10);
+				iobuf = MAX(1, MIN(IOBUFMAX, mb)) << 20;
+			}
+		}
+		if (c[1] == 'P')
+			plist_read(c[2] ? c + 2 : argv[++i]);
+		if (c[1] == 'L')
+			plist_loop = 1;
+		if (c[1] == 'A') {
+			char *arg = c[2] ? c + 2 : argv[++i];
+			loop_beg = atoi(arg) * 1000;
+			loop_end = strchr(arg, ':') ? atoi(strchr(arg, ':') + 1) * 1000 : 0;
+		}
+		if (c[1] == 'g') {
+			char *arg = c[2] ? c + 2 : argv[++i];
+			mos_cols = atoi(arg);
+			mos_rows = strchr(arg, 'x') ? atoi(strchr(arg, 'x') + 1) : 1;
+		}
+		if (c[1] == 'c') {
+			char *arg = c[2] ? c + 2 : argv[++i];
+			sheet_cols = atoi(arg);
+			sheet_rows = strchr(arg, 'x') ? atoi(strchr(arg, 'x') + 1) : 1;
+		}
+		if (c[1] == 'O')
+			sheet_ppm = c[2] ? c + 2 : argv[++i];
+		if (c[1] == 'G')
+			mos_audio = c[2] ? atoi(c + 2) : atoi(argv[++i]);
+		if (c[1] == 'N')
+			mos_nowait = 1;
+		if (c[1] == 'o')
+			startpos = c[2] ? atoi(c + 2) : atoi(argv[++i]);
 		if (c[1] == 'v') {
 			char *arg = c[2] ? c + 2 : argv[++i];
 			video = arg[0] == '-' ? 0 : atoi(arg) + 2;
@@ -488,6 +1182,7 @@ static void read_args(int argc, char *argv[])
 		}
 		i++;
 	}
+	return i;
 }
 
 static void term_init(struct termios *termios)
@@ -506,78 +1201,476 @@ static void term_done(struct termios *termios)
 	tcsetattr(0, 0, termios);
 }
 
+/* startup */
+
+static int oss_err;		/* oss_open() result */
+static int fb_err;		/* fb_init() result */
+
+static void *start_video(void *path)
+{
+	int flags = FFS_VIDEO | (video - 1) | (faststart ? FFS_FAST : 0);
+	if (video && !(vffs = ffs_alloc(path, flags)))
+		video = 0;
+	start_log("video");
+	return NULL;
+}
+
+static void *start_audio(void *path)
+{
+	int flags = FFS_AUDIO | aflags | (audio - 1) | (faststart ? FFS_FAST : 0);
+	if (audio && !(affs = ffs_alloc(path, flags)))
+		audio = 0;
+	if (audio)
+		oss_err = oss_open();
+	start_log("audio");
+	return NULL;
+}
+
+/* opened in parallel with start_video(); released later if there is no video */
+static void *start_fb(void *dev)
+{
+	fb_err = fb_init(dev);
+	fb_on = !fb_err;
+	start_log("framebuffer");
+	return NULL;
+}
+
 static void signalreceived(int sig)
 {
 	if (sig == SIGUSR1)
 		nodraw = 1;
-	if (sig == SIGUSR2)
+	if (sig == SIGUSR2) {
 		nodraw = 0;
+		dmg_reset = 1;
+	}
+	if (sig == SIGRTMIN)
+		perf_req = 1;
+}
+
+/* mosaic: playing several files in framebuffer tiles */
+
+struct tile {
+	struct ffs *ffs;	/* video stream */
+	int x, y, w, h;		/* tile region */
+	float zoom;		/* video zoom */
+	long pos0;		/* the position of the first frame */
+	long frames;		/* decoded frames */
+	int done;		/* the thread has finished */
+	pthread_t thread;
+};
+
+static long mos_t0;		/* the shared clock; ms since the first frames */
+
+static void *tile_play(void *dat)
+{
+	struct tile *t = dat;
+	int w, h, rn, cn, rb, cb;
+	int ret, r;
+	void *buf;
+	ffs_vinfo(t->ffs, &w, &h);
+	rn = MIN(t->h, h * t->zoom);
+	cn = MIN(t->w, w * t->zoom);
+	rb = t->y + (t->h - rn) / 2;
+	cb = t->x + (t->w - cn) / 2;
+	t->pos0 = -1;
+	while (!exited && (ret = ffs_vdec(t->ffs, &buf)) >= 0) {
+		long due, now;
+		if (t->pos0 < 0)
+			t->pos0 = ffs_pos(t->ffs);
+		due = mos_t0 + ffs_pos(t->ffs) - t->pos0;
+		while (!exited && !mos_nowait && (paused || due > (now = ts_ms())))
+			usleep(paused ? 10000 : (due - now) * 1000);
+		if (ret > 0 && !nodraw)
+			for (r = 0; r < rn; r++)
+				draw_row(rb + r, cb, buf + r * ret, cn);
+		t->frames++;
+	}
+	t->done = 1;
+	return NULL;
+}
+
+/* play plist files in mos_cols by mos_rows tiles */
+static int mosaic(char *fbdev)
+{
+	struct tile *tiles;
+	struct termios termios;
+	pthread_t a_thread;
+	long pause_ts = 0;
+	long frames = 0;
+	int n = MIN(plist_n, mos_cols * mos_rows);
+	int running = n;
+	int aeof = 1;
+	int i;
+	if (fb_init(fbdev))
+		return 1;
+	tiles = malloc(n * sizeof(tiles[0]));
+	memset(tiles, 0, n * sizeof(tiles[0]));
+	for (i = 0; i < n; i++) {
+		struct tile *t = &tiles[i];
+		int w, h;
+		t->w = fb_cols() / mos_cols;
+		t->h = fb_rows() / mos_rows;
+		t->x = (i % mos_cols) * t->w;
+		t->y = (i / mos_cols) * t->h;
+		t->ffs = ffs_alloc(plist[i], FFS_VIDEO | FFS_1THREAD |
+				(MAX(1, vsel) - 1) | (faststart ? FFS_FAST : 0));
+		if (!t->ffs) {
+			t->done = 1;
+			running--;
+			continue;
+		}
+		ffs_vinfo(t->ffs, &w, &h);
+		t->zoom = MIN((float) t->w / w, (float) t->h / h);
+		ffs_vconf(t->ffs, t->zoom, fb_mode());
+	}
+	if (asel && mos_audio > 0 && mos_audio <= n &&
+			(affs = ffs_alloc(plist[mos_audio - 1], FFS_AUDIO | (asel - 1)))) {
+		if (!oss_open()) {
+			ffs_aconf(affs, arate);
+			pthread_create(&a_thread, NULL, process_audio, NULL);
+			aeof = 0;
+		}
+	}
+	audio = !aeof;
+	term_init(&termios);
+	mos_t0 = ts_ms();
+	for (i = 0; i < n; i++)
+		if (tiles[i].ffs)
+			pthread_create(&tiles[i].thread, NULL, tile_play, &tiles[i]);
+	while (running && !exited) {
+		int c;
+		while ((c = cmdread()) >= 0) {
+			if (c == 'q')
+				exited = 1;
+			if (c == 'p' || c == ' ') {
+				if (paused)
+					mos_t0 += ts_ms() - pause_ts;
+				else
+					pause_ts = ts_ms();
+				paused = !paused;
+				ring_signal();
+			}
+		}
+		while (!aeof && !paused && a_room())
+			aeof = a_decode();
+		stroll();
+		for (running = 0, i = 0; i < n; i++)
+			running += !tiles[i].done;
+	}
+	exited = 1;
+	ring_signal();
+	for (i = 0; i < n; i++) {
+		if (tiles[i].ffs) {
+			pthread_join(tiles[i].thread, NULL);
+			ffs_free(tiles[i].ffs);
+		}
+		frames += tiles[i].frames;
+	}
+	term_done(&termios);
+	fprintf(stderr, "fbff: %d tiles, %ld frames in %ldms (%ld fps)\n",
+		n, frames, ts_ms() - mos_t0, frames * 1000 / MAX(1, ts_ms() - mos_t0));
+	if (arate) {
+		pthread_join(a_thread, NULL);
+		oss_close();
+	}
+	if (affs)
+		ffs_free(affs);
+	free(tiles);
+	fb_free();
+	return 0;
+}
+
+/* contact sheets */
+
+/* draw a rectangle of the given colour on the framebuffer */
+static void sheet_rect(int rb, int cb, int rn, int cn, unsigned val)
+{
+	int bpp = FBM_BPP(fb_mode());
+	char *row = malloc(cn * bpp);
+	int i;
+	for (i = 0; i < cn; i++)
+		memcpy(row + i * bpp, &val, bpp);
+	for (i = 0; i < rn; i++)
+		draw_row(rb + i, cb, row, cn);
+	free(row);
+}
+
+/* draw tile i of the sheet, with a border if selected */
+static void sheet_tile(char *img, int linelen, int i, int tw, int th, int sel)
+{
+	int bpp = FBM_BPP(fb_mode());
+	int rb = (i / sheet_cols) * th;
+	int cb = (i % sheet_cols) * tw;
+	int r;
+	for (r = 0; r < th; r++)
+		draw_row(rb + r, cb, img + (rb + r) * linelen + cb * bpp, tw);
+	if (sel) {
+		unsigned val = fb_val(255, 255, 0);
+		sheet_rect(rb, cb, 3, tw, val);
+		sheet_rect(rb + th - 3, cb, 3, tw, val);
+		sheet_rect(rb, cb, th, 3, val);
+		sheet_rect(rb, cb + tw - 3, th, 3, val);
+	}
+}
+
+static int sheet_save(char *path, char *img, int w, int h)
+{
+	FILE *fp = fopen(path, "w");
+	int i;
+	if (!fp)
+		return 1;
+	fprintf(fp, "P6\n%d %d\n255\n", w, h);
+	for (i = 0; i < w * h; i++) {
+		unsigned v = ((unsigned *) img)[i];
+		fputc((v >> 16) & 0xff, fp);
+		fputc((v >> 8) & 0xff, fp);
+		fputc(v & 0xff, fp);
+	}
+	return fclose(fp) != 0;
+}
+
+/* show the contact sheet of path; return the selected position or -1 */
+static long sheet(char *path, char *fbdev)
+{
+	struct termios termios;
+	int n = sheet_cols * sheet_rows;
+	unsigned fbm = (4 << 16) | 0x888;
+	int tw = 320, th = 180;
+	long *pos, ret = -1;
+	long ts = ts_ms();
+	int cur = 0, old;
+	int linelen, c, r;
+	char *img;
+	if (!sheet_ppm) {
+		if (fb_init(fbdev))
+			return -1;
+		fbm = fb_mode();
+		tw = fb_cols() / sheet_cols;
+		th = fb_rows() / sheet_rows;
+	}
+	linelen = tw * sheet_cols * FBM_BPP(fbm);
+	img = calloc(th * sheet_rows, linelen);
+	pos = calloc(n, sizeof(pos[0]));
+	if (thumb_sheet(path, sheet_cols, sheet_rows, tw, th, fbm, img, linelen, pos)) {
+		fprintf(stderr, "fbff: cannot make the contact sheet\n");
+	} else if (sheet_ppm) {
+		if (sheet_save(sheet_ppm, img, tw * sheet_cols, th * sheet_rows))
+			fprintf(stderr, "fbff: cannot write %s\n", sheet_ppm);
+		else
+			fprintf(stderr, "fbff: contact sheet in %ldms\n", ts_ms() - ts);
+	} else {
+		for (r = 0; r < th * sheet_rows; r++)
+			draw_row(r, 0, img + r * linelen, tw * sheet_cols);
+		term_init(&termios);
+		sheet_tile(img, linelen, cur, tw, th, 1);
+		while (ret < 0 && !exited) {
+			cmdwait();
+			while ((c = cmdread()) >= 0) {
+				old = cur;
+				if (c == 'h' && cur % sheet_cols)
+					cur--;
+				if (c == 'l' && cur % sheet_cols < sheet_cols - 1 && cur + 1 < n)
+					cur++;
+				if (c == 'k' && cur >= sheet_cols)
+					cur -= sheet_cols;
+				if (c == 'j' && cur + sheet_cols < n)
+					cur += sheet_cols;
+				if (c == '\n' || c == '\r')
+					ret = pos[cur];
+				if (c == 'q')
+					exited = 1;
+				if (old != cur) {
+					sheet_tile(img, linelen, old, tw, th, 0);
+					sheet_tile(img, linelen, cur, tw, th, 1);
+				}
+			}
+		}
+		term_done(&termios);
+		fb_free();
+	}
+	free(pos);
+	free(img);
+	return ret;
+}
+
+/* the number of streams open at once, each with its own buffers */
+static int mem_streams(void)
+{
+	int n = 2 + (sub_path != NULL);
+	if (mos_cols > 0 && mos_rows > 0)
+		return mos_cols * mos_rows + 1;
+	/* the next file of the playlist is opened while playing */
+	if ((plist_n > 1 || plist_loop) && membudget >= PLIST_MEMMIN)
+		n += 2;
+	if (sheet_cols > 0 && sheet_rows > 0)
+		n = MAX(n, MIN(sysconf(_SC_NPROCESSORS_ONLN), sheet_cols * sheet_rows));
+	return n;
 }
 
 int main(int argc, char *argv[])
 {
 	struct termios termios;
 	pthread_t a_thread;
-	char *path = argv[argc - 1];
 	char *fbdev = getenv("FBDEV");
-	if (argc < 2) {
-		printf("usage: %s [-u -s60 ...] file\n", argv[0]);
+	char *path;
+	int ret = 0;
+	int i;
+	ossdsp = getenv("OSSDSP") ? getenv("OSSDSP") : "/dev/dsp";
+	for (i = read_args(argc, argv); i < argc; i++)
+		plist_add(argv[i]);
+	if (!plist_n) {
+		printf("usage: %s [-u -s60 ...] file...\n", argv[0]);
 		return 1;
 	}
-	ossdsp = getenv("OSSDSP") ? getenv("OSSDSP") : "/dev/dsp";
-	read_args(argc, argv);
+	if (rotate % 90) {
+		fprintf(stderr, "fbff: cannot rotate by %d degrees\n", rotate);
+		return 1;
+	}
+	path = plist[0];
+	vsel = video;
+	asel = audio;
+	if (membudget) {
+#ifdef M_ARENA_MAX
+		/* fewer malloc arenas for the threads */
+		mallopt(M_ARENA_MAX, 2);
+#endif
+		ffs_memconf(membudget, mem_streams());
+		iobuf = MIN(iobuf, (membudget / mem_streams()) >> 4);
+		a_blen = MAX(RING_MIN, MIN(RING_LEN, membudget >> 8));
+	}
+	if (ring_init(a_blen)) {
+		fprintf(stderr, "fbff: cannot allocate audio buffers\n");
+		return 1;
+	}
+	if (powersave && !pipe(a_wake)) {
+		fcntl(a_wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(a_wake[1], F_SETFL, O_NONBLOCK);
+	}
 	ffs_globinit();
+	if (iomode)
+		ffs_ioconf(iomode, iobuf);
+	if (trace_path) {
+		perf_trace(TRACE_LEN);
+		atexit(trace_save);
+	}
+	if (mos_cols > 0 && mos_rows > 0)
+		return mosaic(fbdev);
+	if (sheet_cols > 0 && sheet_rows > 0) {
+		long pos = sheet(path, fbdev);
+		if (pos < 0)
+			return 0;
+		startpos = pos / 1000;
+	}
 	snprintf(filename, sizeof(filename), "%s", path);
-	if (video && !(vffs = ffs_alloc(path, FFS_VIDEO | (video - 1))))
-		video = 0;
-	if (audio && !(affs = ffs_alloc(path, FFS_AUDIO | (audio - 1))))
-		audio = 0;
+	start_ts = ts_ms();
+	if (faststart) {
+		pthread_t threads[3];
+		pthread_create(&threads[0], NULL, start_video, path);
+		pthread_create(&threads[1], NULL, start_audio, path);
+		pthread_create(&threads[2], NULL, start_fb, fbdev);
+		pthread_join(threads[0], NULL);
+		pthread_join(threads[1], NULL);
+		pthread_join(threads[2], NULL);
+	} else {
+		start_video(path);
+		start_audio(path);
+	}
 	if (!video && !audio)
 		return 1;
 	if (sub_path)
-		sub_read();
+		sub_open(sub_path);
 	if (audio) {
-		int err = oss_open();
-		ffs_aconf(affs);
-		if (err != 0) {
-			if (err == ENOENT)
+		if (oss_err != 0) {
+			if (oss_err == ENOENT)
 				fprintf(stderr, "fbff: %s missing?\n", ossdsp);
 			else
 				fprintf(stderr, "fbff: %s busy?\n", ossdsp);
 			return 1;
 		}
+		ffs_aconf(affs, arate);
 		pthread_create(&a_thread, NULL, process_audio, NULL);
 	}
+	if (faststart && !video && fb_on) {
+		fb_free();
+		fb_on = 0;
+	}
 	if (video) {
-		int w, h;
-		if (fb_init(fbdev))
+		if (!faststart)
+			start_fb(fbdev);
+		if (fb_err)
 			return 1;
-		ffs_vinfo(vffs, &w, &h);
-		if (fullscreen) {
-			float hz = (float) fb_rows() / h / magnify;
-			float wz = (float) fb_cols() / w / magnify;
-			zoom = hz < wz ? hz : wz;
-		}
+		zoom = item_zoom(vffs);
 		ffs_vconf(vffs, zoom, fb_mode());
+		sub_font = !ovl_init(getenv("FBFONT"));
+		start_log("vconf");
 	}
+	if (loop_end > loop_beg) {
+		cmdloop();
+		if (!startpos)
+			startpos = loop_beg / 1000;
+	}
+	if (startpos)
+		cmdjmp(startpos, 0);
+	plist_load(1);
 	if (getenv("TERM_PGID") != NULL && atoi(getenv("TERM_PGID")) == getppid())
 		if (tcsetpgrp(0, getppid()) == 0)
 			setpgid(0, getppid());
+	if (ctl_path && ctl_open(ctl_path))
+		fprintf(stderr, "fbff: cannot listen on %s\n", ctl_path);
 	term_init(&termios);
 	signal(SIGUSR1, signalreceived);
 	signal(SIGUSR2, signalreceived);
+	if (perf_path)
+		signal(SIGRTMIN, signalreceived);
+	play_ts = ts_ms();
 	mainloop();
+	if (perf_path)
+		perf_save();
+	ctl_close();
 	term_done(&termios);
 	printf("\n");
-
-	if (video) {
+	sub_free();
+	plist_wait();
+	item_free(&next);
+	if (fb_on) {
+		ovl_free();
 		fb_free();
-		ffs_free(vffs);
 	}
-	if (audio) {
+	if (dmg && dmg_all)
+		fprintf(stderr, "fbff: wrote %ldMiB of %ldMiB frames (%ld%% saved)\n",
+			dmg_out >> 20, dmg_all >> 20, 100 - dmg_out * 100 / dmg_all);
+	free(dmg_prev);
+	free(dmg_span);
+	if (vffs)
+		ffs_free(vffs);
+	if (arate) {
 		pthread_join(a_thread, NULL);
 		oss_close();
+	}
+	if (affs)
 		ffs_free(affs);
+	ring_free();
+	if (membudget) {
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		fprintf(stderr, "fbff: peak RSS %ldKiB, budget %ldKiB\n",
+			ru.ru_maxrss, membudget >> 10);
+		if (ru.ru_maxrss > membudget >> 10) {
+			fprintf(stderr, "fbff: memory budget exceeded\n");
+			ret = 1;
+		}
 	}
-	return 0;
+	if (powersave) {
+		struct rusage ru;
+		long ms, cpu;
+		if (paused)
+			pause_ms += ts_ms() - pause_beg;
+		ms = MAX(1, ts_ms() - play_ts - pause_ms);
+		getrusage(RUSAGE_SELF, &ru);
+		cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 +
+			(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+		fprintf(stderr, "fbff: %ld wakeups/s, %ldms CPU per minute played\n",
+			(ru.ru_nvcsw + ru.ru_nivcsw) * 1000 / ms, cpu * 60000 / ms);
+	}
+	return ret;
 }
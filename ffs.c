@@ -1,22 +1,52 @@
 #include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
+#include "blit.h"
 #include "ffs.h"
+#include "fio.h"
+#include "perf.h"
 
 #define FFS_SAMPLEFMT		AV_SAMPLE_FMT_S16
 #define FFS_CHLAYOUT		AV_CH_LAYOUT_STEREO
 #define FFS_CHCNT		2
+#define FFS_PROBESIZE		(1 << 17)	/* FFS_FAST probe size */
+#define FFS_PROBEDUR		200000		/* FFS_FAST probe duration (us) */
+#define FFS_LOOPMEM		(64 << 20)	/* A-B loop packet cache size */
+#define FFS_PROBEMIN		(1 << 15)	/* the smallest probe size */
+#define FFS_ALTN		8		/* maximum standby audio decoders */
+#define FFS_ALTMEM		(1 << 20)	/* the memory reserved for a standby decoder */
+#define FFS_CONVN		4		/* cached video conversions */
+
+/* A-B loop states */
+#define FFS_LREC		1	/* record the packets of the loop */
+#define FFS_LPLAY		2	/* replay recorded packets */
+#define FFS_LSEEK		3	/* the loop is too large; seek instead */
 
 #define MAX(a, b)		((a) < (b) ? (b) : (a))
 #define MIN(a, b)		((a) < (b) ? (a) : (b))
+#define LEN(a)			(sizeof(a) / sizeof((a)[0]))
+
+/* the conversion of decoded frames of one size and format */
+struct ffs_conv {
+	struct SwsContext *swsc;
+	int w, h, fmt;		/* decoded frame size and format */
+	uint8_t *deint[4];	/* deinterlaced frame */
+	int deint_ll[4];	/* deint[] line sizes */
+	long used;		/* last use, for replacing the oldest */
+};
 
 /* ffmpeg stream */
 struct ffs {
@@ -28,12 +58,39 @@ struct ffs {
 	long ts;		/* frame timestamp (ms) */
 	long pts;		/* last decoded packet pts in milliseconds */
 	long dur;		/* last decoded packet duration */
-	struct SwsContext *swsc;
 	struct SwrContext *swrc;
 	AVFrame *dst;		/* used in ffs_vdec() */
+	int vw, vh;		/* the video size given to ffs_vconf() */
+	struct ffs_conv conv[FFS_CONVN];	/* conversions of decoded frames */
+	int conv_n;		/* number of conv[] entries */
+	long conv_cnt;		/* conv[] lookups */
 	AVFrame *tmp;		/* used in ffs_recv() */
+	unsigned *sbmp;		/* the last subtitle bitmap */
+	int sbmp_sz;		/* sbmp allocated size */
+	int srect[4];		/* sbmp position and size */
+	struct fio *fio;	/* custom input */
+	long loop_beg;		/* A-B loop start (ms) */
+	long loop_end;		/* A-B loop end (ms); zero if not looping */
+	int loop_state;		/* A-B loop state (FFS_L*) */
+	int loop_ok;		/* recording started at loop_beg */
+	AVPacket **loop_pkt;	/* recorded packets */
+	int loop_n;		/* number of recorded packets */
+	int loop_sz;		/* allocated loop_pkt entries */
+	int loop_cur;		/* the next packet to replay */
+	long loop_mem;		/* the size of recorded packets */
+	int rate;		/* the sample rate given to ffs_aconf() */
+	AVCodecContext *alt_cc[FFS_ALTN];	/* standby decoders of other audio streams */
+	int alt_si[FFS_ALTN];	/* the streams of alt_cc[] */
+	int alt_n;		/* number of standby decoders */
+	int alt_dec;		/* decode the packets of standby streams */
+	AVFrame *alt_frm;	/* frames decoded by standby decoders */
 };
 
+static int ffs_iomode;		/* custom input mode (FIO_*) */
+static int ffs_iobuf;		/* custom input buffer size */
+static long ffs_mem;		/* memory budget of a stream; zero if unlimited */
+static long ffs_loopmem = FFS_LOOPMEM;	/* A-B loop packet cache size */
+
 static int ffs_stype(int flags)
 {
 	if (flags & FFS_VIDEO)
@@ -45,17 +102,85 @@ static int ffs_stype(int flags)
 	return 0;
 }
 
+static void ffs_loopdrop(struct ffs *ffs)
+{
+	int i;
+	for (i = 0; i < ffs->loop_n; i++)
+		av_packet_free(&ffs->loop_pkt[i]);
+	ffs->loop_n = 0;
+	ffs->loop_mem = 0;
+	ffs->loop_cur = 0;
+}
+
+/* open standby decoders for the other audio streams */
+static void ffs_altopen(struct ffs *ffs)
+{
+	/* standby decoders get a sixteenth of the budget of the stream */
+	int n = ffs_mem ? MIN(FFS_ALTN, (ffs_mem >> 4) / FFS_ALTMEM) : FFS_ALTN;
+	int i;
+	for (i = 0; i < ffs->fc->nb_streams && ffs->alt_n < n; i++) {
+		AVCodecParameters *par = ffs->fc->streams[i]->codecpar;
+		const AVCodec *dec = avcodec_find_decoder(par->codec_id);
+		AVCodecContext *cc;
+		if (i == ffs->si || par->codec_type != AVMEDIA_TYPE_AUDIO || !dec)
+			continue;
+		if (!(cc = avcodec_alloc_context3(dec)))
+			continue;
+		avcodec_parameters_to_context(cc, par);
+		cc->thread_count = 1;
+		if (avcodec_open2(cc, dec, NULL)) {
+			avcodec_free_context(&cc);
+			continue;
+		}
+		ffs->alt_cc[ffs->alt_n] = cc;
+		ffs->alt_si[ffs->alt_n++] = i;
+	}
+	if (ffs->alt_n && ffs->alt_dec)
+		ffs->alt_frm = av_frame_alloc();
+}
+
+/* decode a packet of another audio stream to keep its decoder ready */
+static void ffs_altdec(struct ffs *ffs, AVPacket *pkt)
+{
+	int i;
+	for (i = 0; i < ffs->alt_n; i++) {
+		if (ffs->alt_si[i] == pkt->stream_index) {
+			avcodec_send_packet(ffs->alt_cc[i], pkt);
+			while (avcodec_receive_frame(ffs->alt_cc[i], ffs->alt_frm) == 0)
+				;
+			return;
+		}
+	}
+}
+
 struct ffs *ffs_alloc(char *path, int flags)
 {
 	struct ffs *ffs;
 	int idx = (flags & FFS_STRIDX) - 1;
 	AVDictionary *opt = NULL;
+	AVDictionary *fopt = NULL;
 	const AVCodec *dec = NULL;
 	ffs = malloc(sizeof(*ffs));
 	memset(ffs, 0, sizeof(*ffs));
 	ffs->si = -1;
-	if (avformat_open_input(&ffs->fc, path, NULL, NULL))
+	if (flags & FFS_FAST) {
+		av_dict_set_int(&fopt, "probesize", FFS_PROBESIZE, 0);
+		av_dict_set_int(&fopt, "analyzeduration", FFS_PROBEDUR, 0);
+	}
+	if (ffs_mem) {
+		long probe = MAX(FFS_PROBEMIN, ffs_mem >> 7);
+		if (!(flags & FFS_FAST) || probe < FFS_PROBESIZE)
+			av_dict_set_int(&fopt, "probesize", probe, 0);
+		av_dict_set_int(&fopt, "max_index_size", probe, 0);
+	}
+	if (ffs_iomode && (ffs->fio = fio_open(path, ffs_iomode, ffs_iobuf))) {
+		ffs->fc = avformat_alloc_context();
+		ffs->fc->pb = fio_avio(ffs->fio);
+		ffs->fc->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+	if (avformat_open_input(&ffs->fc, path, NULL, &fopt))
 		goto failed;
+	av_dict_free(&fopt);
 	if (avformat_find_stream_info(ffs->fc, NULL) < 0)
 		goto failed;
 	ffs->si = av_find_best_stream(ffs->fc, ffs_stype(flags), idx, -1, NULL, 0);
@@ -68,65 +193,183 @@ struct ffs *ffs_alloc(char *path, int flags)
 	if (ffs->cc == NULL)
 		goto failed;
 	avcodec_parameters_to_context(ffs->cc, ffs->fc->streams[ffs->si]->codecpar);
+	if (flags & FFS_1THREAD)
+		ffs->cc->thread_count = 1;
+	/* frame threads keep a frame each; slice threads do not */
+	if (ffs_mem && !(flags & FFS_1THREAD)) {
+		ffs->cc->thread_count = ffs_mem < (64 << 20) ? 1 : 2;
+		ffs->cc->thread_type = FF_THREAD_SLICE;
+	}
 	if (avcodec_open2(ffs->cc, avcodec_find_decoder(ffs->cc->codec_id), &opt))
 		goto failed;
 	ffs->st = ffs->fc->streams[ffs->si];
 	ffs->tmp = av_frame_alloc();
 	ffs->dst = av_frame_alloc();
+	ffs->alt_dec = (flags & FFS_ALTDEC) != 0;
+	if (flags & FFS_ALTS)
+		ffs_altopen(ffs);
 	return ffs;
 failed:
+	av_dict_free(&fopt);
 	ffs_free(ffs);
 	return NULL;
 }
 
+static void ffs_convfree(struct ffs_conv *cv)
+{
+	if (cv->swsc)
+		sws_freeContext(cv->swsc);
+	av_freep(&cv->deint[0]);
+	memset(cv, 0, sizeof(*cv));
+}
+
 void ffs_free(struct ffs *ffs)
 {
+	int i;
 	if (ffs->swrc)
 		swr_free(&ffs->swrc);
-	if (ffs->swsc)
-		sws_freeContext(ffs->swsc);
-	if (ffs->dst)
+	for (i = 0; i < ffs->conv_n; i++)
+		ffs_convfree(&ffs->conv[i]);
+	if (ffs->dst) {
+		av_free(ffs->dst->data[0]);
 		av_free(ffs->dst);
+	}
 	if (ffs->tmp)
 		av_free(ffs->tmp);
+	free(ffs->sbmp);
+	ffs_loopdrop(ffs);
+	free(ffs->loop_pkt);
+	for (i = 0; i < ffs->alt_n; i++)
+		avcodec_free_context(&ffs->alt_cc[i]);
+	if (ffs->alt_frm)
+		av_frame_free(&ffs->alt_frm);
 	if (ffs->cc)
 		avcodec_close(ffs->cc);
 	if (ffs->fc)
 		avformat_close_input(&ffs->fc);
+	if (ffs->fio)
+		fio_close(ffs->fio);
 	free(ffs);
 }
 
+/* update stream position after reading pkt */
+static void ffs_pktpos(struct ffs *ffs, AVPacket *pkt)
+{
+	long pts = (pkt->dts == AV_NOPTS_VALUE ? 0 : pkt->dts) *
+		av_q2d(ffs->st->time_base) * 1000;
+	ffs->dur = MIN(MAX(0, pts - ffs->pts), 1000);
+	if (pts > ffs->pts || pts + 200 < ffs->pts)
+		ffs->pts = pts;
+}
+
+static void ffs_looprec(struct ffs *ffs, AVPacket *pkt)
+{
+	if (ffs->loop_n == ffs->loop_sz) {
+		int sz = ffs->loop_sz ? ffs->loop_sz * 2 : 512;
+		AVPacket **pkts = realloc(ffs->loop_pkt, sz * sizeof(pkts[0]));
+		if (!pkts) {
+			ffs->loop_state = FFS_LSEEK;
+			return;
+		}
+		ffs->loop_pkt = pkts;
+		ffs->loop_sz = sz;
+	}
+	ffs->loop_mem += pkt->size;
+	if (ffs->loop_mem > ffs_loopmem ||
+			!(ffs->loop_pkt[ffs->loop_n] = av_packet_clone(pkt))) {
+		ffs_loopdrop(ffs);
+		ffs->loop_state = FFS_LSEEK;
+		return;
+	}
+	ffs->loop_n++;
+}
+
+/* return to the start of the loop; replay recorded packets if possible */
+static void ffs_loopwrap(struct ffs *ffs)
+{
+	if (ffs->loop_state == FFS_LREC && ffs->loop_ok && ffs->loop_n) {
+		ffs->loop_state = FFS_LPLAY;
+		ffs->loop_cur = 0;
+		return;
+	}
+	if (ffs->loop_state != FFS_LSEEK) {
+		ffs_loopdrop(ffs);
+		ffs->loop_state = FFS_LREC;
+		ffs->loop_ok = 1;
+	}
+	av_seek_frame(ffs->fc, ffs->si, ffs->loop_beg / av_q2d(ffs->st->time_base) / 1000,
+		AVSEEK_FLAG_BACKWARD);
+}
+
 static AVPacket *ffs_pkt(struct ffs *ffs)
 {
 	AVPacket *pkt = &ffs->pkt;
-	while (av_read_frame(ffs->fc, pkt) >= 0) {
-		if (pkt->stream_index == ffs->si) {
-			long pts = (pkt->dts == AV_NOPTS_VALUE ? 0 : pkt->dts) *
-				av_q2d(ffs->st->time_base) * 1000;
-			ffs->dur = MIN(MAX(0, pts - ffs->pts), 1000);
-			if (pts > ffs->pts || pts + 200 < ffs->pts)
-				ffs->pts = pts;
+	int wraps = 0;
+	while (1) {
+		long pts, t;
+		int ret;
+		if (ffs->loop_state == FFS_LPLAY) {
+			if (ffs->loop_cur == ffs->loop_n)
+				ffs->loop_cur = 0;
+			if (av_packet_ref(pkt, ffs->loop_pkt[ffs->loop_cur++]) < 0)
+				return NULL;
+			ffs_pktpos(ffs, pkt);
 			return pkt;
 		}
-		av_packet_unref(pkt);
+		t = perf_now();
+		ret = av_read_frame(ffs->fc, pkt);
+		if (ffs->cc->codec_type != AVMEDIA_TYPE_SUBTITLE)
+			perf_span(PERF_DEMUX, t);
+		if (ret < 0) {
+			if (!ffs->loop_end || wraps++)
+				return NULL;
+			ffs_loopwrap(ffs);
+			continue;
+		}
+		if (pkt->stream_index != ffs->si) {
+			if (ffs->alt_frm)
+				ffs_altdec(ffs, pkt);
+			av_packet_unref(pkt);
+			continue;
+		}
+		pts = (pkt->dts == AV_NOPTS_VALUE ? 0 : pkt->dts) *
+			av_q2d(ffs->st->time_base) * 1000;
+		if (ffs->loop_end && pts >= ffs->loop_end) {
+			av_packet_unref(pkt);
+			if (wraps++)
+				return NULL;
+			ffs_loopwrap(ffs);
+			continue;
+		}
+		ffs_pktpos(ffs, pkt);
+		if (ffs->loop_state == FFS_LREC)
+			ffs_looprec(ffs, pkt);
+		return pkt;
 	}
-	return NULL;
 }
 
 static AVFrame *ffs_recv(struct ffs *ffs)
 {
 	AVCodecContext *vcc = ffs->cc;
 	AVPacket *pkt = NULL;
+	int id = vcc->codec_type == AVMEDIA_TYPE_VIDEO ? PERF_VDEC : PERF_ADEC;
 	int errcnt = 0;
 	int ret;
+	long t;
 	while (1) {
-		if ((ret = avcodec_receive_frame(vcc, ffs->tmp)) == 0)
+		t = perf_now();
+		ret = avcodec_receive_frame(vcc, ffs->tmp);
+		perf_span(id, t);
+		if (ret == 0)
 			return ffs->tmp;
 		if (ret < 0 && ret != AVERROR(EAGAIN))
 			return NULL;
 		if ((pkt = ffs_pkt(ffs)) == NULL)
 			return NULL;
-		if ((ret = avcodec_send_packet(vcc, pkt)) < 0) {
+		t = perf_now();
+		ret = avcodec_send_packet(vcc, pkt);
+		perf_span(id, t);
+		if (ret < 0) {
 			av_packet_unref(pkt);
 			if (ret == AVERROR(EOF) || errcnt++ == 3)
 				return NULL;
@@ -143,29 +386,51 @@ static long ts_ms(void)
 	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-static int wait(long ts, int vdelay)
+/* milliseconds until the next video frame is due; zero if it is due */
+long ffs_due(struct ffs *ffs)
 {
+	long vdelay = MAX(ffs->dur, 20);
 	long nts = ts_ms();
-	if (nts > ts && ts + vdelay > nts) {
-		usleep((ts + vdelay - nts) * 1000);
-		return 0;
+	return nts > ffs->ts && ffs->ts + vdelay > nts ? ffs->ts + vdelay - nts : 0;
+}
+
+/* advance the clock by one frame; reset it if the frame is late */
+static void ffs_tick(struct ffs *ffs, long nts)
+{
+	long vdelay = MAX(ffs->dur, 20);
+	long due = ffs->ts + vdelay;
+	if (ffs->ts && nts > ffs->ts && nts < due + vdelay / 2) {
+		ffs->ts = due;
+		return;
 	}
-	return 1;
+	if (ffs->ts && nts >= due)
+		perf_inc(PERF_LATE);
+	ffs->ts = nts;			/* out of sync */
 }
 
 void ffs_wait(struct ffs *ffs)
 {
-	int vdelay = ffs->dur;
-	if (!wait(ffs->ts, MAX(vdelay, 20)))
-		ffs->ts += MAX(vdelay, 20);
-	else
-		ffs->ts = ts_ms();		/* out of sync */
+	long due = ffs_due(ffs);
+	if (due > 0) {
+		long t = perf_now();
+		usleep(due * 1000);
+		perf_span(PERF_SLACK, t);
+	}
+	ffs_tick(ffs, ts_ms());
 }
 
 /* audio/video frame offset difference */
 int ffs_avdiff(struct ffs *ffs, struct ffs *affs)
 {
-	return affs->pts - ffs->pts;
+	long len = ffs->loop_end - ffs->loop_beg;
+	long diff = affs->pts - ffs->pts;
+	if (ffs->loop_end && affs->loop_end) {	/* one stream has wrapped */
+		if (diff > len / 2)
+			diff -= len;
+		if (diff < -len / 2)
+			diff += len;
+	}
+	return diff;
 }
 
 long ffs_pos(struct ffs *ffs)
@@ -173,17 +438,47 @@ long ffs_pos(struct ffs *ffs)
 	return ffs->pts;
 }
 
+/* the index of the stream in its file */
+int ffs_sidx(struct ffs *ffs)
+{
+	return ffs->si;
+}
+
 void ffs_seek(struct ffs *ffs, struct ffs *vffs, long pos)
 {
 	av_seek_frame(ffs->fc, vffs->si,
 		pos / av_q2d(vffs->st->time_base) / 1000, 0);
 	ffs->ts = 0;
+	if (ffs->cc->skip_frame == AVDISCARD_NONKEY)
+		avcodec_flush_buffers(ffs->cc);
+	if (ffs->loop_end && ffs->loop_state != FFS_LSEEK) {
+		ffs_loopdrop(ffs);
+		ffs->loop_state = FFS_LREC;
+		ffs->loop_ok = pos == ffs->loop_beg;
+	}
+}
+
+/* loop between beg and end (ms); packets are kept in memory after the first pass */
+void ffs_loop(struct ffs *ffs, long beg, long end)
+{
+	ffs_loopdrop(ffs);
+	ffs->loop_beg = beg;
+	ffs->loop_end = end > beg ? end : 0;
+	ffs->loop_state = end > beg ? FFS_LREC : 0;
+	ffs->loop_ok = 0;
+}
+
+/* decode only key frames */
+void ffs_keyonly(struct ffs *ffs)
+{
+	ffs->cc->skip_frame = AVDISCARD_NONKEY;
 }
 
+/* the video size; after ffs_vconf(), the size of its converted frames */
 void ffs_vinfo(struct ffs *ffs, int *w, int *h)
 {
-	*h = ffs->cc->height;
-	*w = ffs->cc->width;
+	*h = ffs->vh ? ffs->vh : ffs->cc->height;
+	*w = ffs->vw ? ffs->vw : ffs->cc->width;
 }
 
 void ffs_ainfo(struct ffs *ffs, int *rate, int *bps, int *ch)
@@ -193,49 +488,236 @@ void ffs_ainfo(struct ffs *ffs, int *rate, int *bps, int *ch)
 	*bps = 16;
 }
 
+/* the conversion of frames of the size and format of frm */
+static struct ffs_conv *ffs_conv(struct ffs *ffs, AVFrame *frm)
+{
+	AVFrame *dst = ffs->dst;
+	struct ffs_conv *cv = NULL;
+	int i;
+	for (i = 0; i < ffs->conv_n && !cv; i++)
+		if (ffs->conv[i].w == frm->width && ffs->conv[i].h == frm->height &&
+				ffs->conv[i].fmt == frm->format)
+			cv = &ffs->conv[i];
+	if (!cv && ffs->conv_n < FFS_CONVN)
+		cv = &ffs->conv[ffs->conv_n++];
+	if (!cv) {
+		cv = &ffs->conv[0];
+		for (i = 1; i < ffs->conv_n; i++)
+			if (ffs->conv[i].used < cv->used)
+				cv = &ffs->conv[i];
+		ffs_convfree(cv);
+	}
+	if (!cv->w) {
+		cv->w = frm->width;
+		cv->h = frm->height;
+		cv->fmt = frm->format;
+		cv->swsc = sws_getContext(frm->width, frm->height, frm->format,
+			dst->width, dst->height, dst->format,
+			SWS_FAST_BILINEAR, NULL, NULL, NULL);
+	}
+	cv->used = ++ffs->conv_cnt;
+	return cv;
+}
+
+static int ffs_interlaced(AVFrame *frm)
+{
+#ifdef AV_FRAME_FLAG_INTERLACED
+	return (frm->flags & AV_FRAME_FLAG_INTERLACED) != 0;
+#else
+	return frm->interlaced_frame;
+#endif
+}
+
+/* deinterlace 8-bit planar frames into cv->deint; returns nonzero on failure */
+static int ffs_deint(struct ffs_conv *cv, AVFrame *frm)
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frm->format);
+	int np = av_pix_fmt_count_planes(frm->format);
+	int i, p, r;
+	if (!desc || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) ||
+			(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+				AV_PIX_FMT_FLAG_HWACCEL)))
+		return 1;
+	for (i = 0; i < desc->nb_components; i++)
+		if (desc->comp[i].depth != 8)
+			return 1;
+	if (!cv->deint[0] && av_image_alloc(cv->deint, cv->deint_ll,
+			frm->width, frm->height, frm->format, 16) < 0)
+		return 1;
+	for (p = 0; p < np && p < 4; p++) {
+		int sh = p == 1 || p == 2 ? desc->log2_chroma_h : 0;
+		int rn = AV_CEIL_RSHIFT(frm->height, sh);
+		int n = av_image_get_linesize(frm->format, frm->width, p);
+		uint8_t *s = frm->data[p];
+		int sll = frm->linesize[p];
+		for (r = 0; r < rn; r++)
+			blit_deint(cv->deint[p] + r * cv->deint_ll[p],
+				s + (r > 0 ? r - 1 : r) * sll, s + r * sll,
+				s + (r + 1 < rn ? r + 1 : r) * sll, n);
+	}
+	return 0;
+}
+
+/* whether frm precedes the start of the A-B loop */
+static int ffs_vearly(struct ffs *ffs, AVFrame *frm)
+{
+	long ts = frm->best_effort_timestamp;
+	if (!ffs->loop_end || ts == AV_NOPTS_VALUE)
+		return 0;
+	return ts * av_q2d(ffs->st->time_base) * 1000 < ffs->loop_beg;
+}
+
 int ffs_vdec(struct ffs *ffs, void **buf)
 {
 	AVFrame *tmp = ffs_recv(ffs);
 	AVFrame *dst = ffs->dst;
+	struct ffs_conv *cv;
+	uint8_t **src;
+	int *sll;
+	long t;
+	/*
+	 * after wrapping, A-B loops restart at the key frame before
+	 * loop_beg; like the audio samples before loop_beg in ffs_adec(),
+	 * the frames before it are decoded but not shown or timed
+	 */
+	while (tmp && ffs_vearly(ffs, tmp))
+		tmp = ffs_recv(ffs);
 	if (tmp == NULL)
 		return -1;
-	if (buf) {
-		sws_scale(ffs->swsc, (void *) tmp->data, tmp->linesize,
-			  0, ffs->cc->height, dst->data, dst->linesize);
-		*buf = (void *) dst->data[0];
-		return dst->linesize[0];
+	if (!buf)
+		return 0;
+	t = perf_now();
+	/* the size or the format of frames may change in the stream */
+	cv = ffs_conv(ffs, tmp);
+	if (!cv->swsc)
+		return 0;
+	src = tmp->data;
+	sll = tmp->linesize;
+	if (ffs_interlaced(tmp) && !ffs_deint(cv, tmp)) {
+		src = cv->deint;
+		sll = cv->deint_ll;
 	}
-	return 0;
+	sws_scale(cv->swsc, (void *) src, sll, 0, tmp->height,
+		dst->data, dst->linesize);
+	perf_span(PERF_SCALE, t);
+	*buf = (void *) dst->data[0];
+	return dst->linesize[0];
+}
+
+/* copy subtitle text, removing ass override codes and trailing newlines */
+static int ffs_stext(char *d, int dlen, char *s)
+{
+	char *d0 = d;
+	char *e = d + dlen - 1;
+	while (*s && d < e) {
+		if (s[0] == '{' && strchr(s, '}')) {
+			s = strchr(s, '}') + 1;
+			continue;
+		}
+		if (s[0] == '\\' && (s[1] == 'N' || s[1] == 'n')) {
+			*d++ = '\n';
+			s += 2;
+			continue;
+		}
+		if (s[0] != '\r')
+			*d++ = s[0];
+		s++;
+	}
+	while (d > d0 && d[-1] == '\n')
+		d--;
+	*d = '\0';
+	return d - d0;
+}
+
+/* merge the bitmap rects of sub into ffs->sbmp */
+static void ffs_sbmpdec(struct ffs *ffs, AVSubtitle *sub)
+{
+	int x0 = INT_MAX, y0 = INT_MAX, x1 = 0, y1 = 0;
+	int i, r, c, w;
+	ffs->srect[2] = 0;
+	ffs->srect[3] = 0;
+	for (i = 0; i < sub->num_rects; i++) {
+		AVSubtitleRect *rect = sub->rects[i];
+		if (rect->type != SUBTITLE_BITMAP || rect->w <= 0 || rect->h <= 0)
+			continue;
+		x0 = MIN(x0, rect->x);
+		y0 = MIN(y0, rect->y);
+		x1 = MAX(x1, rect->x + rect->w);
+		y1 = MAX(y1, rect->y + rect->h);
+	}
+	if (x1 <= x0 || y1 <= y0)
+		return;
+	w = x1 - x0;
+	if (w * (y1 - y0) > ffs->sbmp_sz) {
+		free(ffs->sbmp);
+		ffs->sbmp_sz = w * (y1 - y0);
+		ffs->sbmp = malloc(ffs->sbmp_sz * sizeof(ffs->sbmp[0]));
+		if (!ffs->sbmp) {
+			ffs->sbmp_sz = 0;
+			return;
+		}
+	}
+	memset(ffs->sbmp, 0, w * (y1 - y0) * sizeof(ffs->sbmp[0]));
+	for (i = 0; i < sub->num_rects; i++) {
+		AVSubtitleRect *rect = sub->rects[i];
+		uint32_t *pal = (void *) rect->data[1];
+		if (rect->type != SUBTITLE_BITMAP || rect->w <= 0 || rect->h <= 0)
+			continue;
+		for (r = 0; r < rect->h; r++) {
+			unsigned char *src = rect->data[0] + r * rect->linesize[0];
+			unsigned *dst = ffs->sbmp + (rect->y - y0 + r) * w + rect->x - x0;
+			for (c = 0; c < rect->w; c++)
+				dst[c] = pal[src[c]];
+		}
+	}
+	ffs->srect[0] = x0;
+	ffs->srect[1] = y0;
+	ffs->srect[2] = w;
+	ffs->srect[3] = y1 - y0;
+}
+
+/* the bitmap of the last subtitle decoded by ffs_sdec() */
+unsigned *ffs_sbmp(struct ffs *ffs, int *rect)
+{
+	memcpy(rect, ffs->srect, sizeof(ffs->srect));
+	return ffs->srect[2] ? ffs->sbmp : NULL;
 }
 
 int ffs_sdec(struct ffs *ffs, char *buf, int blen, long *beg, long *end)
 {
 	AVPacket *pkt = ffs_pkt(ffs);
 	AVSubtitle sub = {0};
-	AVSubtitleRect *rect;
 	int fine = 0;
-	int i;
+	int len = 0;
+	int i, j;
 	if (!pkt)
 		return -1;
 	avcodec_decode_subtitle2(ffs->cc, &sub, &fine, pkt);
 	av_packet_unref(pkt);
 	buf[0] = '\0';
+	ffs->srect[2] = 0;
 	if (!fine)
 		return 1;
-	rect = sub.num_rects ? sub.rects[0] : NULL;
-	if (rect && rect->text)
-		snprintf(buf, blen, "%s", sub.rects[0]->text);
-	if (rect && !rect->text && rect->ass) {
-		char *s = rect->ass;
-		for (i = 0; s && i < 9; i++)
-			s = strchr(s, ',') ? strchr(s, ',') + 1 : NULL;
-		if (s)
-			snprintf(buf, blen, "%s", s);
-	}
-	if (strchr(buf, '\n'))
-		*strchr(buf, '\n') = '\0';
-	*beg = ffs->pts + sub.start_display_time * av_q2d(ffs->st->time_base) * 1000;
-	*end = ffs->pts + sub.end_display_time * av_q2d(ffs->st->time_base) * 1000;
+	for (i = 0; i < sub.num_rects && len + 1 < blen; i++) {
+		AVSubtitleRect *rect = sub.rects[i];
+		char *s = rect->text;
+		if (!s && rect->ass) {
+			s = rect->ass;
+			for (j = 0; s && j < 9; j++)
+				s = strchr(s, ',') ? strchr(s, ',') + 1 : NULL;
+		}
+		if (!s)
+			continue;
+		if (len)
+			buf[len++] = '\n';
+		len += ffs_stext(buf + len, blen - len, s);
+	}
+	ffs_sbmpdec(ffs, &sub);
+	/* display times are in milliseconds; bitmaps may not specify the end */
+	*beg = ffs->pts + sub.start_display_time;
+	*end = ffs->pts + sub.end_display_time;
+	if (sub.end_display_time <= sub.start_display_time || sub.end_display_time == UINT32_MAX)
+		*end = LONG_MAX;
 	avsubtitle_free(&sub);
 	return 0;
 }
@@ -249,15 +731,35 @@ int ffs_adec(struct ffs *ffs, void *buf, int blen)
 {
 	AVFrame *tmp = ffs_recv(ffs);
 	uint8_t *out[] = {buf};
-	int len;
+	const uint8_t *in[64];
+	int beg = 0;
+	int end;
+	int len, i;
 	if (tmp == NULL)
 		return -1;
+	end = tmp->nb_samples;
+	/* drop the samples outside A-B loops */
+	if (ffs->loop_end && tmp->pts != AV_NOPTS_VALUE) {
+		double t0 = tmp->pts * av_q2d(ffs->st->time_base) * 1000;
+		beg = MAX(0, (ffs->loop_beg - t0) * ffs->cc->sample_rate / 1000);
+		end = MIN(end, (ffs->loop_end - t0) * ffs->cc->sample_rate / 1000);
+		if (beg >= end)
+			return 0;
+	}
+	if (beg) {
+		int planar = av_sample_fmt_is_planar(ffs->cc->sample_fmt);
+		int ch = ffs->cc->ch_layout.nb_channels;
+		int step = av_get_bytes_per_sample(ffs->cc->sample_fmt) * (planar ? 1 : ch);
+		for (i = 0; i < (planar ? ch : 1) && i < LEN(in); i++)
+			in[i] = tmp->extended_data[i] + beg * step;
+	}
 	len = swr_convert(ffs->swrc, out, blen / ffs_bytespersample(ffs),
-		(void *) tmp->extended_data, tmp->nb_samples);
+		beg ? in : (void *) tmp->extended_data, end - beg);
 	return len > 0 ? len * ffs_bytespersample(ffs) : 0;
 }
 
-static int fbm2pixfmt(int fbm)
+/* the ffmpeg pixel format of fb_mode() fbm */
+int ffs_pixfmt(int fbm)
 {
 	switch (fbm & 0x0fff) {
 	case 0x888:
@@ -276,24 +778,26 @@ void ffs_vconf(struct ffs *ffs, float zoom, int fbm)
 {
 	int h = ffs->cc->height;
 	int w = ffs->cc->width;
-	int fmt = ffs->cc->pix_fmt;
-	int pixfmt = fbm2pixfmt(fbm);
+	int pixfmt = ffs_pixfmt(fbm);
 	uint8_t *buf = NULL;
 	int n;
-	ffs->swsc = sws_getContext(w, h, fmt, w * zoom, h * zoom,
-			pixfmt, SWS_FAST_BILINEAR,
-			NULL, NULL, NULL);
+	/* frames of other sizes are scaled to this size in ffs_vdec() */
+	ffs->vw = w;
+	ffs->vh = h;
+	ffs->dst->width = w * zoom;
+	ffs->dst->height = h * zoom;
+	ffs->dst->format = pixfmt;
 	n = av_image_get_buffer_size(pixfmt, w * zoom, h * zoom, 8);
 	buf = av_malloc(n * sizeof(uint8_t));
 	av_image_fill_arrays(ffs->dst->data, ffs->dst->linesize, buf,
 		pixfmt, w * zoom, h * zoom, 8);
 }
 
-void ffs_aconf(struct ffs *ffs)
+/* convert decoded audio to the given sample rate */
+void ffs_aconf(struct ffs *ffs, int rate)
 {
-	int rate, bps, ch;
-	ffs_ainfo(ffs, &rate, &bps, &ch);
 	AVChannelLayout chlayout;
+	ffs->rate = rate;
 	av_channel_layout_from_mask(&chlayout, FFS_CHLAYOUT);
 	swr_alloc_set_opts2(&ffs->swrc,
 		&chlayout, FFS_SAMPLEFMT, rate,
@@ -301,10 +805,92 @@ void ffs_aconf(struct ffs *ffs)
 	swr_init(ffs->swrc);
 }
 
+/*
+ * switch to audio stream idx, or to the next one if idx is negative;
+ * returns the new stream index or -1.  The switch needs no seek: with
+ * FFS_ALTDEC, the standby decoder of the stream has been fed all of
+ * its packets and continues where it is; otherwise it was idle, is
+ * flushed, and decodes from the next packet of the stream.
+ */
+int ffs_aswitch(struct ffs *ffs, int idx)
+{
+	AVCodecContext *cc = ffs->cc;
+	int si = ffs->si;
+	int i = 0;
+	if (!ffs->alt_n)
+		return -1;
+	if (idx >= 0)
+		for (i = 0; i < ffs->alt_n && ffs->alt_si[i] != idx; i++)
+			;
+	else	/* the next stream after the current one */
+		for (i = 0; i < ffs->alt_n && ffs->alt_si[i] < si; i++)
+			;
+	if (i == ffs->alt_n && idx >= 0)
+		return -1;
+	if (i == ffs->alt_n)
+		i = 0;
+	ffs->cc = ffs->alt_cc[i];
+	ffs->si = ffs->alt_si[i];
+	ffs->st = ffs->fc->streams[ffs->si];
+	/* keep the standby streams sorted */
+	for (; i > 0 && ffs->alt_si[i - 1] > si; i--) {
+		ffs->alt_cc[i] = ffs->alt_cc[i - 1];
+		ffs->alt_si[i] = ffs->alt_si[i - 1];
+	}
+	for (; i + 1 < ffs->alt_n && ffs->alt_si[i + 1] < si; i++) {
+		ffs->alt_cc[i] = ffs->alt_cc[i + 1];
+		ffs->alt_si[i] = ffs->alt_si[i + 1];
+	}
+	ffs->alt_cc[i] = cc;
+	ffs->alt_si[i] = si;
+	/* an idle decoder may hold the state of its last use */
+	if (!ffs->alt_dec)
+		avcodec_flush_buffers(ffs->cc);
+	if (ffs->swrc) {
+		swr_free(&ffs->swrc);
+		ffs_aconf(ffs, ffs->rate);
+	}
+	/* the replayed packets of A-B loops are of the old stream */
+	if (ffs->loop_state == FFS_LPLAY) {
+		ffs_loopdrop(ffs);
+		ffs->loop_state = FFS_LREC;
+		ffs->loop_ok = 0;
+		av_seek_frame(ffs->fc, ffs->si,
+			ffs->pts / av_q2d(ffs->st->time_base) / 1000, AVSEEK_FLAG_BACKWARD);
+	} else if (ffs->loop_state == FFS_LREC) {
+		ffs_loopdrop(ffs);
+		ffs->loop_ok = 0;
+	}
+	return ffs->si;
+}
+
 void ffs_globinit(void)
 {
 }
 
+/* read files through fio with the given mode and buffer size */
+void ffs_ioconf(int mode, int bufsz)
+{
+	ffs_iomode = mode;
+	ffs_iobuf = bufsz;
+}
+
+/* limit the memory used by n streams open at once to about mem bytes */
+void ffs_memconf(long mem, int n)
+{
+	ffs_mem = mem / MAX(1, n);
+	ffs_loopmem = MIN(FFS_LOOPMEM, ffs_mem >> 3);
+}
+
+/* input statistics; return nonzero if ffs does not use fio */
+int ffs_iostat(struct ffs *ffs, long *nread, long *nstall, int *fill)
+{
+	if (!ffs->fio)
+		return 1;
+	fio_stat(ffs->fio, nread, nstall, fill);
+	return 0;
+}
+
 long ffs_duration(struct ffs *ffs)
 {
 	if (ffs->st->duration != AV_NOPTS_VALUE)
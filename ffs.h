@@ -1,29 +1,43 @@
 #define FFS_AUDIO	0x1000
 #define FFS_VIDEO	0x2000
 #define FFS_SUBTS	0x4000
+#define FFS_FAST	0x8000	/* limit stream probing */
+#define FFS_1THREAD	0x10000	/* decode in a single thread */
+#define FFS_ALTS	0x20000	/* keep other audio streams ready for ffs_aswitch() */
+#define FFS_ALTDEC	0x40000	/* with FFS_ALTS, decode the other streams too */
 #define FFS_STRIDX	0x0fff
 
 void ffs_globinit(void);
+void ffs_ioconf(int mode, int bufsz);
+void ffs_memconf(long mem, int n);
 
 /* ffmpeg stream */
 struct ffs *ffs_alloc(char *path, int flags);
 void ffs_free(struct ffs *ffs);
 
 long ffs_pos(struct ffs *ffs);
+int ffs_sidx(struct ffs *ffs);
 long ffs_duration(struct ffs *ffs);
 void ffs_seek(struct ffs *ffs, struct ffs *vffs, long pos);
+void ffs_loop(struct ffs *ffs, long beg, long end);
 void ffs_wait(struct ffs *ffs);
+long ffs_due(struct ffs *ffs);
 int ffs_avdiff(struct ffs *ffs, struct ffs *affs);
+int ffs_iostat(struct ffs *ffs, long *nread, long *nstall, int *fill);
 
 /* audio */
-void ffs_aconf(struct ffs *ffs);
+void ffs_aconf(struct ffs *ffs, int rate);
 void ffs_ainfo(struct ffs *ffs, int *rate, int *bps, int *ch);
 int ffs_adec(struct ffs *ffs, void *buf, int blen);
+int ffs_aswitch(struct ffs *ffs, int idx);
 
 /* video */
 void ffs_vconf(struct ffs *ffs, float zoom, int fbm);
 void ffs_vinfo(struct ffs *ffs, int *w, int *h);
+void ffs_keyonly(struct ffs *ffs);
+int ffs_pixfmt(int fbm);
 int ffs_vdec(struct ffs *ffs, void **buf);
 
 /* subtitles */
 int ffs_sdec(struct ffs *ffs, char *buf, int blen, long *beg, long *end);
+unsigned *ffs_sbmp(struct ffs *ffs, int *rect);
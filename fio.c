@@ -0,0 +1,218 @@
+/*
+ * file input for ffmpeg
+ *
+ * In FIO_MMAP mode, the file is memory-mapped and copied from.  In
+ * FIO_AHEAD mode, a thread reads the file in large chunks into a ring
+ * buffer ahead of the demuxer; seeks inside the buffered region only
+ * skip data.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include "fio.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define FIO_AVBUF	(1 << 16)	/* AVIOContext buffer size */
+#define FIO_CHUNK	(1 << 18)	/* readahead read size */
+
+struct fio {
+	int fd;
+	int mode;
+	long size;		/* file size */
+	long pos;		/* read position */
+	char *map;		/* FIO_MMAP: the mapped file */
+	char *buf;		/* FIO_AHEAD: readahead ring buffer */
+	int bufsz;		/* ring buffer size */
+	int head;		/* ring buffer index of pos */
+	int fill;		/* buffered bytes after pos */
+	int gen;		/* incremented when the buffer is dropped */
+	int eof;		/* the reader reached the end of file */
+	int quit;		/* stop the reader */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	AVIOContext *avio;
+	long nread;		/* bytes read by the demuxer */
+	long nstall;		/* reads that waited for the reader */
+};
+
+static int fio_mread(void *dat, uint8_t *buf, int len)
+{
+	struct fio *fio = dat;
+	int n = MIN(len, fio->size - fio->pos);
+	if (n <= 0)
+		return AVERROR_EOF;
+	memcpy(buf, fio->map + fio->pos, n);
+	fio->pos += n;
+	fio->nread += n;
+	return n;
+}
+
+static int fio_aread(void *dat, uint8_t *buf, int len)
+{
+	struct fio *fio = dat;
+	int n;
+	pthread_mutex_lock(&fio->lock);
+	if (!fio->fill && !fio->eof)
+		fio->nstall++;
+	while (!fio->fill && !fio->eof)
+		pthread_cond_wait(&fio->cond, &fio->lock);
+	if (!fio->fill) {
+		pthread_mutex_unlock(&fio->lock);
+		return AVERROR_EOF;
+	}
+	n = MIN(len, MIN(fio->fill, fio->bufsz - fio->head));
+	memcpy(buf, fio->buf + fio->head, n);
+	fio->head = (fio->head + n) % fio->bufsz;
+	fio->fill -= n;
+	fio->pos += n;
+	fio->nread += n;
+	pthread_cond_broadcast(&fio->cond);
+	pthread_mutex_unlock(&fio->lock);
+	return n;
+}
+
+static int64_t fio_seek(void *dat, int64_t off, int whence)
+{
+	struct fio *fio = dat;
+	long pos;
+	if (whence & AVSEEK_SIZE)
+		return fio->size;
+	pthread_mutex_lock(&fio->lock);
+	pos = off;
+	if ((whence & 3) == SEEK_CUR)
+		pos = fio->pos + off;
+	if ((whence & 3) == SEEK_END)
+		pos = fio->size + off;
+	if (pos < 0 || pos > fio->size) {
+		pthread_mutex_unlock(&fio->lock);
+		return -1;
+	}
+	if (fio->mode == FIO_AHEAD && pos >= fio->pos && pos < fio->pos + fio->fill) {
+		fio->head = (fio->head + pos - fio->pos) % fio->bufsz;
+		fio->fill -= pos - fio->pos;
+	} else if (fio->mode == FIO_AHEAD) {
+		fio->head = 0;
+		fio->fill = 0;
+		fio->eof = 0;
+		fio->gen++;
+	}
+	fio->pos = pos;
+	pthread_cond_broadcast(&fio->cond);
+	pthread_mutex_unlock(&fio->lock);
+	return pos;
+}
+
+static void *fio_ahead(void *dat)
+{
+	struct fio *fio = dat;
+	pthread_mutex_lock(&fio->lock);
+	while (!fio->quit) {
+		long off = fio->pos + fio->fill;
+		int idx = (fio->head + fio->fill) % fio->bufsz;
+		int n = MIN(FIO_CHUNK, MIN(fio->bufsz - fio->fill, fio->bufsz - idx));
+		int gen = fio->gen;
+		int ret;
+		if (n <= 0 || fio->eof) {
+			pthread_cond_wait(&fio->cond, &fio->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&fio->lock);
+		posix_fadvise(fio->fd, off + n, fio->bufsz / 2, POSIX_FADV_WILLNEED);
+		ret = pread(fio->fd, fio->buf + idx, n, off);
+		pthread_mutex_lock(&fio->lock);
+		if (gen != fio->gen)
+			continue;
+		if (ret > 0)
+			fio->fill += ret;
+		else
+			fio->eof = 1;
+		pthread_cond_broadcast(&fio->cond);
+	}
+	pthread_mutex_unlock(&fio->lock);
+	return NULL;
+}
+
+struct fio *fio_open(char *path, int mode, int bufsz)
+{
+	struct fio *fio;
+	struct stat st;
+	unsigned char *avbuf;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	fio = malloc(sizeof(*fio));
+	memset(fio, 0, sizeof(*fio));
+	fio->fd = fd;
+	fio->mode = mode;
+	fio->size = st.st_size;
+	pthread_mutex_init(&fio->lock, NULL);
+	pthread_cond_init(&fio->cond, NULL);
+	if (mode == FIO_MMAP) {
+		fio->map = mmap(NULL, fio->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (fio->map == MAP_FAILED) {
+			fio->map = NULL;
+			fio_close(fio);
+			return NULL;
+		}
+		madvise(fio->map, fio->size, MADV_SEQUENTIAL);
+	} else {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		fio->bufsz = bufsz;
+		if (!(fio->buf = malloc(bufsz))) {
+			fio_close(fio);
+			return NULL;
+		}
+		pthread_create(&fio->thread, NULL, fio_ahead, fio);
+	}
+	avbuf = av_malloc(FIO_AVBUF);
+	fio->avio = avio_alloc_context(avbuf, FIO_AVBUF, 0, fio,
+		mode == FIO_MMAP ? fio_mread : fio_aread, NULL, fio_seek);
+	return fio;
+}
+
+void fio_close(struct fio *fio)
+{
+	if (fio->buf) {
+		pthread_mutex_lock(&fio->lock);
+		fio->quit = 1;
+		pthread_cond_broadcast(&fio->cond);
+		pthread_mutex_unlock(&fio->lock);
+		pthread_join(fio->thread, NULL);
+		free(fio->buf);
+	}
+	if (fio->map)
+		munmap(fio->map, fio->size);
+	if (fio->avio) {
+		av_freep(&fio->avio->buffer);
+		avio_context_free(&fio->avio);
+	}
+	pthread_mutex_destroy(&fio->lock);
+	pthread_cond_destroy(&fio->cond);
+	close(fio->fd);
+	free(fio);
+}
+
+/* the AVIOContext for reading the file */
+void *fio_avio(struct fio *fio)
+{
+	return fio->avio;
+}
+
+void fio_stat(struct fio *fio, long *nread, long *nstall, int *fill)
+{
+	*nread = fio->nread;
+	*nstall = fio->nstall;
+	*fill = fio->bufsz ? (long) fio->fill * 100 / fio->bufsz : 100;
+}
@@ -0,0 +1,8 @@
+/* file input for ffmpeg */
+#define FIO_MMAP	1	/* read memory-mapped files */
+#define FIO_AHEAD	2	/* read ahead in a thread */
+
+struct fio *fio_open(char *path, int mode, int bufsz);
+void fio_close(struct fio *fio);
+void *fio_avio(struct fio *fio);
+void fio_stat(struct fio *fio, long *nread, long *nstall, int *fill);
@@ -0,0 +1,105 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "font.h"
+
+struct font {
+	int rows, cols;	/* glyph bitmap rows and columns */
+	int n;		/* number of font glyphs */
+	int *glyphs;	/* glyph unicode character codes */
+	char *data;	/* glyph bitmaps */
+};
+
+/*
+ * This tinyfont header is followed by:
+ *
+ * glyphs[n]	unicode character codes (int)
+ * bitmaps[n]	character bitmaps (char[rows * cols])
+ */
+struct tinyfont {
+	char sig[8];	/* tinyfont signature; "tinyfont" */
+	int ver;	/* version; 0 */
+	int n;		/* number of glyphs */
+	int rows, cols;	/* glyph dimensions */
+};
+
+static int xread(int fd, void *buf, int len)
+{
+	int nr = 0;
+	while (nr < len) {
+		int ret = read(fd, buf + nr, len - nr);
+		if (ret <= 0)
+			return -1;
+		nr += ret;
+	}
+	return nr;
+}
+
+struct font *font_open(char *path)
+{
+	struct font *font;
+	struct tinyfont head;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (xread(fd, &head, sizeof(head)) < 0 || memcmp(head.sig, "tinyfont", 8) ||
+			head.n <= 0 || head.rows <= 0 || head.cols <= 0) {
+		close(fd);
+		return NULL;
+	}
+	font = malloc(sizeof(*font));
+	font->n = head.n;
+	font->rows = head.rows;
+	font->cols = head.cols;
+	font->glyphs = malloc(font->n * sizeof(int));
+	font->data = malloc(font->n * font->rows * font->cols);
+	if (xread(fd, font->glyphs, font->n * sizeof(int)) < 0 ||
+			xread(fd, font->data, font->n * font->rows * font->cols) < 0) {
+		close(fd);
+		font_free(font);
+		return NULL;
+	}
+	close(fd);
+	return font;
+}
+
+static int find_glyph(struct font *font, int c)
+{
+	int l = 0;
+	int h = font->n;
+	while (l < h) {
+		int m = (l + h) / 2;
+		if (font->glyphs[m] == c)
+			return m;
+		if (c < font->glyphs[m])
+			h = m;
+		else
+			l = m + 1;
+	}
+	return -1;
+}
+
+/* return the alpha bitmap of glyph c */
+char *font_bitmap(struct font *font, int c)
+{
+	int i = find_glyph(font, c);
+	return i >= 0 ? font->data + i * font->rows * font->cols : NULL;
+}
+
+void font_free(struct font *font)
+{
+	free(font->data);
+	free(font->glyphs);
+	free(font);
+}
+
+int font_rows(struct font *font)
+{
+	return font->rows;
+}
+
+int font_cols(struct font *font)
+{
+	return font->cols;
+}
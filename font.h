@@ -0,0 +1,6 @@
+/* tinyfont fonts */
+struct font *font_open(char *path);
+void font_free(struct font *font);
+int font_rows(struct font *font);
+int font_cols(struct font *font);
+char *font_bitmap(struct font *font, int c);
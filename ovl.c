@@ -0,0 +1,281 @@
+/*
+ * subtitle overlay
+ *
+ * The overlay is composed in fb_mode() pixels with an alpha channel
+ * whenever visible subtitles change, and is blended into the rows of
+ * each video frame it covers.  Outlined glyphs are rendered once into
+ * a glyph atlas.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "blit.h"
+#include "draw.h"
+#include "font.h"
+#include "sub.h"
+#include "ovl.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+#define GLYPHCNT	256		/* glyph atlas slots */
+
+static struct font *font;
+static int grows, gcols;		/* atlas glyph dimensions */
+static int atlas_code[GLYPHCNT];	/* the glyph in each atlas slot */
+static char *atlas_pix;			/* atlas glyph pixels */
+static unsigned char *atlas_alpha;	/* atlas glyph alpha */
+static unsigned fbm;			/* fb_mode() */
+static int bpp;				/* bytes per pixel */
+
+static int ovl_y, ovl_w, ovl_h;		/* overlay rows and width */
+static char *ovl_pix;			/* overlay pixels */
+static unsigned char *ovl_alpha;	/* overlay alpha */
+static short *ovl_beg, *ovl_end;	/* visible span of overlay rows */
+
+/* initialise the overlay; return nonzero if text cannot be rendered */
+int ovl_init(char *path)
+{
+	int i;
+	fbm = fb_mode();
+	bpp = FBM_BPP(fbm);
+	if (!path || !(font = font_open(path)))
+		return 1;
+	grows = font_rows(font) + 2;
+	gcols = font_cols(font) + 2;
+	atlas_pix = malloc(GLYPHCNT * grows * gcols * bpp);
+	atlas_alpha = malloc(GLYPHCNT * grows * gcols);
+	if (!atlas_pix || !atlas_alpha) {
+		ovl_free();
+		return 1;
+	}
+	for (i = 0; i < GLYPHCNT; i++)
+		atlas_code[i] = -1;
+	return 0;
+}
+
+void ovl_free(void)
+{
+	if (font)
+		font_free(font);
+	free(atlas_pix);
+	free(atlas_alpha);
+	free(ovl_pix);
+	free(ovl_alpha);
+	free(ovl_beg);
+	free(ovl_end);
+	font = NULL;
+	atlas_pix = NULL;
+	atlas_alpha = NULL;
+	ovl_pix = NULL;
+	ovl_alpha = NULL;
+	ovl_beg = NULL;
+	ovl_end = NULL;
+	ovl_h = 0;
+}
+
+static void putpix(char *d, unsigned v)
+{
+	if (bpp == 4)
+		*(unsigned *) d = v;
+	else if (bpp == 2)
+		*(unsigned short *) d = v;
+	else
+		memcpy(d, &v, bpp);
+}
+
+/* return the atlas slot of glyph c; glyphs are drawn white with a black outline */
+static int atlas_glyph(int c)
+{
+	int slot = c & (GLYPHCNT - 1);
+	char *bits = font_bitmap(font, c);
+	int frows = font_rows(font);
+	int fcols = font_cols(font);
+	char *pix;
+	unsigned char *alpha;
+	int r, c1, i, j;
+	if (atlas_code[slot] == c)
+		return slot;
+	if (!bits)
+		return -1;
+	pix = atlas_pix + slot * grows * gcols * bpp;
+	alpha = atlas_alpha + slot * grows * gcols;
+	for (r = 0; r < grows; r++) {
+		for (c1 = 0; c1 < gcols; c1++) {
+			int a = 0;
+			int s = 0;
+			if (r > 0 && r <= frows && c1 > 0 && c1 <= fcols)
+				a = (unsigned char) bits[(r - 1) * fcols + c1 - 1];
+			for (i = r - 2; i <= r; i++)
+				for (j = c1 - 2; j <= c1; j++)
+					if (i >= 0 && i < frows && j >= 0 && j < fcols)
+						s = MAX(s, (unsigned char) bits[i * fcols + j]);
+			alpha[r * gcols + c1] = MAX(a, s);
+			putpix(pix + (r * gcols + c1) * bpp, fb_val(a, a, a));
+		}
+	}
+	atlas_code[slot] = c;
+	return slot;
+}
+
+static int utf8get(char **s)
+{
+	unsigned char *p = (void *) *s;
+	int c = *p++;
+	int n = 0;
+	if (c >= 0xf0)
+		c &= 0x07, n = 3;
+	else if (c >= 0xe0)
+		c &= 0x0f, n = 2;
+	else if (c >= 0xc0)
+		c &= 0x1f, n = 1;
+	while (n-- > 0 && (*p & 0xc0) == 0x80)
+		c = (c << 6) | (*p++ & 0x3f);
+	*s = (void *) p;
+	return c;
+}
+
+/* copy an atlas glyph into the overlay */
+static void ovl_glyph(int slot, int y, int x)
+{
+	char *pix = atlas_pix + slot * grows * gcols * bpp;
+	unsigned char *alpha = atlas_alpha + slot * grows * gcols;
+	int r, c;
+	for (r = 0; r < grows; r++) {
+		for (c = 0; c < gcols; c++) {
+			int a = alpha[r * gcols + c];
+			int i = (y + r) * ovl_w + x + c;
+			if (x + c < 0 || x + c >= ovl_w || y + r < 0 || y + r >= ovl_h)
+				continue;
+			if (a > ovl_alpha[i]) {
+				ovl_alpha[i] = a;
+				memcpy(ovl_pix + i * bpp, pix + (r * gcols + c) * bpp, bpp);
+			}
+		}
+	}
+}
+
+static void ovl_text(char *s, int y)
+{
+	int n = 0;
+	char *t = s;
+	int x;
+	while (*t && *t != '\n') {
+		utf8get(&t);
+		n++;
+	}
+	x = (ovl_w - n * (gcols - 2)) / 2 - 1;
+	while (*s && *s != '\n') {
+		int slot = atlas_glyph(utf8get(&s));
+		if (slot >= 0)
+			ovl_glyph(slot, y, x);
+		x += gcols - 2;
+	}
+}
+
+static void ovl_bitmap(struct sub *sub, int x, int y, int w, int h)
+{
+	unsigned *argb = malloc(sub->w * sub->h * sizeof(argb[0]));
+	int r, c;
+	if (!argb)
+		return;
+	sub_bitmap(sub, argb);
+	for (r = MAX(0, -y); r < h && y + r < ovl_h; r++) {
+		unsigned *src = argb + (r * sub->h / h) * sub->w;
+		for (c = MAX(0, -x); c < w && x + c < ovl_w; c++) {
+			unsigned v = src[c * sub->w / w];
+			int i = (y + r) * ovl_w + x + c;
+			ovl_alpha[i] = v >> 24;
+			putpix(ovl_pix + i * bpp, fb_val((v >> 16) & 0xff,
+				(v >> 8) & 0xff, v & 0xff));
+		}
+	}
+	free(argb);
+}
+
+/* compose the overlay of subtitles for a w by h video frame */
+void ovl_make(struct sub **subs, int n, int w, int h, float zoom)
+{
+	int bx[16], by[16], bw[16], bh[16];
+	int y0 = h, y1 = 0;
+	int ty = h, lines = 0;
+	int i, r, c;
+	char *s;
+	ovl_h = 0;
+	for (i = 0; i < n && i < 16; i++) {
+		for (s = subs[i]->text; font && s; s = strchr(s, '\n') ? strchr(s, '\n') + 1 : NULL)
+			lines++;
+		if (subs[i]->img) {
+			float zx = subs[i]->cw ? (float) w / subs[i]->cw : zoom;
+			float zy = subs[i]->ch ? (float) h / subs[i]->ch : zoom;
+			bx[i] = subs[i]->x * zx;
+			by[i] = subs[i]->y * zy;
+			bw[i] = MAX(1, subs[i]->w * zx);
+			bh[i] = MAX(1, subs[i]->h * zy);
+			y0 = MIN(y0, by[i]);
+			y1 = MAX(y1, by[i] + bh[i]);
+		}
+	}
+	if (lines) {
+		ty = h - h / 20 - lines * (grows - 2);
+		y0 = MIN(y0, ty);
+		y1 = MAX(y1, ty + lines * (grows - 2) + 2);
+	}
+	y0 = MAX(0, y0);
+	y1 = MIN(h, y1);
+	if (y0 >= y1)
+		return;
+	free(ovl_pix);
+	free(ovl_alpha);
+	free(ovl_beg);
+	free(ovl_end);
+	ovl_y = y0;
+	ovl_w = w;
+	ovl_h = y1 - y0;
+	ovl_pix = malloc(ovl_w * ovl_h * bpp);
+	ovl_alpha = malloc(ovl_w * ovl_h);
+	ovl_beg = malloc(ovl_h * sizeof(ovl_beg[0]));
+	ovl_end = malloc(ovl_h * sizeof(ovl_end[0]));
+	if (!ovl_pix || !ovl_alpha || !ovl_beg || !ovl_end) {
+		free(ovl_pix);
+		free(ovl_alpha);
+		free(ovl_beg);
+		free(ovl_end);
+		ovl_pix = NULL;
+		ovl_alpha = NULL;
+		ovl_beg = NULL;
+		ovl_end = NULL;
+		ovl_h = 0;
+		return;
+	}
+	memset(ovl_alpha, 0, ovl_w * ovl_h);
+	for (i = 0; i < n && i < 16; i++)
+		if (subs[i]->img)
+			ovl_bitmap(subs[i], bx[i], by[i] - y0, bw[i], bh[i]);
+	for (i = 0; i < n && font; i++) {
+		for (s = subs[i]->text; s; s = strchr(s, '\n') ? strchr(s, '\n') + 1 : NULL) {
+			ovl_text(s, ty - y0);
+			ty += grows - 2;
+		}
+	}
+	for (r = 0; r < ovl_h; r++) {
+		unsigned char *a = ovl_alpha + r * ovl_w;
+		for (c = 0; c < ovl_w && !a[c]; c++)
+			;
+		ovl_beg[r] = c;
+		for (c = ovl_w; c > ovl_beg[r] && !a[c - 1]; c--)
+			;
+		ovl_end[r] = c;
+	}
+}
+
+/* blend the overlay into the given video frame */
+void ovl_draw(void *img, int linelen)
+{
+	int r;
+	for (r = 0; r < ovl_h; r++) {
+		int beg = ovl_beg[r];
+		if (beg < ovl_end[r])
+			blit_blend(img + (ovl_y + r) * linelen + beg * bpp,
+				ovl_pix + (r * ovl_w + beg) * bpp,
+				ovl_alpha + r * ovl_w + beg, ovl_end[r] - beg, fbm);
+	}
+}
@@ -0,0 +1,5 @@
+/* subtitle overlay */
+int ovl_init(char *path);
+void ovl_free(void);
+void ovl_make(struct sub **subs, int n, int w, int h, float zoom);
+void ovl_draw(void *img, int linelen);
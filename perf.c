@@ -0,0 +1,186 @@
+/*
+ * performance counters
+ *
+ * Each measurement adds a sample to the count, the sum, and a
+ * histogram whose buckets hold the samples of each bit length.  The
+ * counters are updated with relaxed atomic additions, since some are
+ * shared between threads, and are read without locking.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "perf.h"
+
+#define PERF_HIST	24	/* histogram buckets */
+#define PERF_THREADS	16	/* maximum number of traced threads */
+
+#define ADD(p, v)	__atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+
+struct perf {
+	long cnt;		/* number of samples */
+	long sum;		/* sum of samples */
+	long max;		/* the largest sample */
+	long last;		/* the last sample */
+	long hist[PERF_HIST];	/* samples by bit length */
+};
+
+/* a trace span or event */
+struct span {
+	long beg;		/* start time (us) */
+	int dur;		/* duration (us); negative for events */
+	int id;			/* PERF_* stage or event */
+};
+
+/* the trace of a thread */
+struct trace {
+	struct span *spans;	/* ring buffer of perf_tlen spans */
+	long n;			/* the number of recorded spans */
+};
+
+static struct perf perf[PERF_N];
+static long perf_evs[PERF_NEVS];
+
+static struct trace perf_tr[PERF_THREADS];
+static int perf_tn;		/* the number of claimed perf_tr entries */
+static int perf_tlen;		/* spans per thread; zero if not tracing */
+static long perf_t0;		/* tracing start time */
+static struct trace perf_tnone;	/* for threads without a trace */
+static __thread struct trace *perf_cur;	/* the trace of this thread */
+
+static char *perf_name[PERF_N] = {
+	"demux", "vdec", "adec", "scale", "draw", "awrite", "slack", "reset",
+	"drift", "ring",
+};
+static char *perf_unit[PERF_N] = {
+	"us", "us", "us", "us", "us", "us", "us", "us", "ms", "buf",
+};
+static char *perf_evname[PERF_NEVS] = {"drop", "late", "xrun"};
+
+/* monotonic time in microseconds */
+long perf_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void perf_add(int id, long val)
+{
+	struct perf *p = &perf[id];
+	int b = 0;
+	if (val < 0)
+		val = 0;
+	while (b < PERF_HIST - 1 && val >> b)
+		b++;
+	ADD(&p->cnt, 1);
+	ADD(&p->sum, val);
+	ADD(&p->hist[b], 1);
+	__atomic_store_n(&p->last, val, __ATOMIC_RELAXED);
+	if (val > __atomic_load_n(&p->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&p->max, val, __ATOMIC_RELAXED);
+}
+
+static void perf_rec(int id, long beg, int dur)
+{
+	struct trace *tr = perf_cur;
+	struct span *sp;
+	if (!tr) {
+		int i = ADD(&perf_tn, 1);
+		tr = perf_cur = i < PERF_THREADS ? &perf_tr[i] : &perf_tnone;
+		/* the spans of a thread are allocated when it records its first */
+		if (tr != &perf_tnone)
+			tr->spans = malloc(perf_tlen * sizeof(tr->spans[0]));
+		if (!tr->spans)
+			tr = perf_cur = &perf_tnone;
+	}
+	if (!tr->spans)
+		return;
+	sp = &tr->spans[tr->n % perf_tlen];
+	sp->beg = beg;
+	sp->dur = dur;
+	sp->id = id;
+	__atomic_store_n(&tr->n, tr->n + 1, __ATOMIC_RELEASE);
+}
+
+/* record a sample of stage id that started at beg */
+void perf_span(int id, long beg)
+{
+	long now = perf_now();
+	perf_add(id, now - beg);
+	if (perf_tlen)
+		perf_rec(id, beg, now - beg);
+}
+
+void perf_inc(int ev)
+{
+	ADD(&perf_evs[ev], 1);
+	if (perf_tlen)
+		perf_rec(ev, perf_now(), -1);
+}
+
+long perf_mean(int id)
+{
+	return perf[id].cnt ? perf[id].sum / perf[id].cnt : 0;
+}
+
+long perf_events(int ev)
+{
+	return perf_evs[ev];
+}
+
+/* write the counters as "name.field value" lines */
+void perf_write(FILE *fp)
+{
+	int i, j;
+	for (i = 0; i < PERF_N; i++) {
+		struct perf *p = &perf[i];
+		fprintf(fp, "%s.unit %s\n", perf_name[i], perf_unit[i]);
+		fprintf(fp, "%s.count %ld\n", perf_name[i], p->cnt);
+		fprintf(fp, "%s.sum %ld\n", perf_name[i], p->sum);
+		fprintf(fp, "%s.mean %ld\n", perf_name[i], perf_mean(i));
+		fprintf(fp, "%s.max %ld\n", perf_name[i], p->max);
+		fprintf(fp, "%s.last %ld\n", perf_name[i], p->last);
+		/* bucket j holds samples below 2^j */
+		fprintf(fp, "%s.hist", perf_name[i]);
+		for (j = 0; j < PERF_HIST; j++)
+			fprintf(fp, " %ld", p->hist[j]);
+		fprintf(fp, "\n");
+	}
+	for (i = 0; i < PERF_NEVS; i++)
+		fprintf(fp, "%s %ld\n", perf_evname[i], perf_evs[i]);
+}
+
+/* start tracing; the last len spans of each thread are kept */
+void perf_trace(int len)
+{
+	perf_t0 = perf_now();
+	perf_tlen = len;
+}
+
+/* write the trace in Chrome trace event format */
+int perf_tracesave(char *path)
+{
+	FILE *fp = fopen(path, "w");
+	char *sep = "";
+	int i;
+	long j;
+	if (!fp)
+		return 1;
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (i = 0; i < PERF_THREADS && i < perf_tn; i++) {
+		struct trace *tr = &perf_tr[i];
+		long n = __atomic_load_n(&tr->n, __ATOMIC_ACQUIRE);
+		for (j = n > perf_tlen ? n - perf_tlen : 0; j < n; j++) {
+			struct span *sp = &tr->spans[j % perf_tlen];
+			if (sp->dur >= 0)
+				fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%ld,\"dur\":%d,\"pid\":1,\"tid\":%d}",
+					sep, perf_name[sp->id], sp->beg - perf_t0, sp->dur, i + 1);
+			else
+				fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%ld,\"pid\":1,\"tid\":%d}",
+					sep, perf_evname[sp->id], sp->beg - perf_t0, i + 1);
+			sep = ",\n";
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) != 0;
+}
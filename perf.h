@@ -0,0 +1,30 @@
+/* performance counters */
+#define PERF_DEMUX	0	/* reading a packet (us) */
+#define PERF_VDEC	1	/* decoding video (us) */
+#define PERF_ADEC	2	/* decoding audio (us) */
+#define PERF_SCALE	3	/* converting a video frame (us) */
+#define PERF_DRAW	4	/* drawing a video frame (us) */
+#define PERF_AWRITE	5	/* writing to the audio device (us) */
+#define PERF_SLACK	6	/* waiting for the next frame time (us) */
+#define PERF_RESET	7	/* resetting audio after seeks (us) */
+#define PERF_DRIFT	8	/* A/V drift (ms) */
+#define PERF_RING	9	/* filled audio ring buffers */
+#define PERF_N		10
+
+/* events */
+#define PERF_DROP	0	/* video frames not drawn */
+#define PERF_LATE	1	/* video frames decoded too late */
+#define PERF_XRUN	2	/* audio device underruns */
+#define PERF_NEVS	3
+
+long perf_now(void);
+void perf_add(int id, long val);
+void perf_span(int id, long beg);
+void perf_inc(int ev);
+long perf_mean(int id);
+long perf_events(int ev);
+void perf_write(FILE *fp);
+
+/* tracing */
+void perf_trace(int len);
+int perf_tracesave(char *path);
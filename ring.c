@@ -0,0 +1,136 @@
+/*
+ * audio buffer ring
+ *
+ * The main thread decodes audio into the buffer at the head of the
+ * ring and the audio thread writes the buffers at its tail to the
+ * sound device.  The indices are published with release stores, so
+ * that a buffer is complete when the other thread sees it; the lock
+ * and the condition variable are used only by threads going to sleep
+ * until the ring or other shared state changes.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include "ring.h"
+
+#define LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static char *ring_buf[RING_N];
+static int ring_len[RING_N];
+static int ring_sz;		/* the length of ring_buf[] buffers */
+static int ring_prod;		/* the buffer being filled */
+static int ring_cons;		/* the next buffer to play */
+static pthread_mutex_t ring_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cnd = PTHREAD_COND_INITIALIZER;
+
+/* allocate buffers of len bytes; returns nonzero on failure */
+int ring_init(int len)
+{
+	int i;
+	ring_sz = len;
+	for (i = 0; i < RING_N; i++)
+		if (!(ring_buf[i] = malloc(len)))
+			return 1;
+	return 0;
+}
+
+void ring_free(void)
+{
+	int i;
+	for (i = 0; i < RING_N; i++) {
+		free(ring_buf[i]);
+		ring_buf[i] = NULL;
+	}
+}
+
+int ring_size(void)
+{
+	return ring_sz;
+}
+
+int ring_full(void)
+{
+	return ((ring_prod + 1) & (RING_N - 1)) == LOAD(&ring_cons);
+}
+
+char *ring_head(void)
+{
+	return ring_buf[ring_prod];
+}
+
+/* pass the head buffer, with len bytes, to the consumer */
+void ring_put(int len)
+{
+	ring_len[ring_prod] = len;
+	STORE(&ring_prod, (ring_prod + 1) & (RING_N - 1));
+	ring_signal();
+}
+
+int ring_empty(void)
+{
+	return ring_cons == LOAD(&ring_prod);
+}
+
+/* the number of filled buffers */
+int ring_used(void)
+{
+	return (LOAD(&ring_prod) - LOAD(&ring_cons)) & (RING_N - 1);
+}
+
+/* the bytes in filled buffers; called by the producer */
+int ring_bytes(void)
+{
+	int i, n = 0;
+	for (i = LOAD(&ring_cons); i != ring_prod; i = (i + 1) & (RING_N - 1))
+		n += ring_len[i];
+	return n;
+}
+
+char *ring_tail(int *len)
+{
+	*len = ring_len[ring_cons];
+	return ring_buf[ring_cons];
+}
+
+/* return the tail buffer to the producer */
+void ring_take(void)
+{
+	STORE(&ring_cons, (ring_cons + 1) & (RING_N - 1));
+	ring_signal();
+}
+
+/* drop the filled buffers */
+void ring_drop(void)
+{
+	STORE(&ring_cons, LOAD(&ring_prod));
+}
+
+void ring_lock(void)
+{
+	pthread_mutex_lock(&ring_mtx);
+}
+
+void ring_unlock(void)
+{
+	pthread_mutex_unlock(&ring_mtx);
+}
+
+/* sleep until ring_wake(); the lock should be held */
+void ring_wait(void)
+{
+	pthread_cond_wait(&ring_cnd, &ring_mtx);
+}
+
+/* wake up the sleeping threads; the lock should be held */
+void ring_wake(void)
+{
+	pthread_cond_broadcast(&ring_cnd);
+}
+
+/* wake up the sleeping threads */
+void ring_signal(void)
+{
+	ring_lock();
+	ring_wake();
+	ring_unlock();
+}
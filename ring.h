@@ -0,0 +1,28 @@
+/* audio buffer ring */
+#define RING_N		(1 << 3)	/* number of buffers */
+#define RING_LEN	(1 << 18)	/* default buffer length */
+#define RING_MIN	(1 << 15)	/* the smallest buffer length */
+
+int ring_init(int len);
+void ring_free(void);
+int ring_size(void);
+
+/* the producer */
+int ring_full(void);
+char *ring_head(void);
+void ring_put(int len);
+
+/* the consumer */
+int ring_empty(void);
+int ring_used(void);
+int ring_bytes(void);
+char *ring_tail(int *len);
+void ring_take(void);
+void ring_drop(void);
+
+/* sleeping until the ring changes */
+void ring_lock(void);
+void ring_unlock(void);
+void ring_wait(void);
+void ring_wake(void);
+void ring_signal(void);
@@ -0,0 +1,304 @@
+/*
+ * subtitle store
+ *
+ * Subtitles are decoded in a background thread and inserted into an
+ * array sorted by their start position; their text and bitmaps are
+ * kept in a growing arena.  Bitmaps are run-length encoded.  Lookups
+ * keep a cursor and the set of active subtitles, which are updated
+ * incrementally during normal playback; the array is searched only
+ * after seeks.
+ */
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ffs.h"
+#include "sub.h"
+
+#define SUBBLK		(1 << 16)	/* arena block size */
+#define SUBTLEN		4096		/* maximum subtitle text length */
+#define SUBACT		16		/* maximum active subtitles */
+#define SUBSTEP		32		/* cursor steps before searching */
+
+#define MAX(a, b)	((a) < (b) ? (b) : (a))
+
+struct subent {
+	long beg;		/* printing position */
+	long end;		/* hiding position */
+	long maxend;		/* maximum end of this and previous entries */
+	struct sub *sub;	/* subtitle contents */
+};
+
+static struct subent *subs;	/* subtitles sorted by beg */
+static int subs_n;		/* subtitle count */
+static int subs_sz;		/* allocated entries */
+static int subs_gen;		/* incremented if entries are reordered */
+static pthread_mutex_t subs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char **arena;		/* arena blocks */
+static int arena_n;		/* number of arena blocks */
+static int arena_len;		/* used bytes of the last block */
+
+static int cur;			/* entries before cur start before cur_pos */
+static long cur_pos;		/* the position of the last lookup */
+static int cur_gen = -1;	/* subs_gen when cur was computed */
+static int act[SUBACT];		/* active subtitles */
+static int act_n;		/* number of active subtitles */
+static int act_over;		/* some active subtitles did not fit in act[] */
+
+static char *sub_path;		/* subtitles file */
+static pthread_t sub_thread;	/* the loading thread */
+static int sub_started;		/* sub_thread was created */
+static int sub_stop;		/* stop loading */
+
+static void *arena_alloc(int len)
+{
+	void *d;
+	len = (len + 7) & ~7;
+	if (!arena_n || arena_len + len > SUBBLK) {
+		char **blks = realloc(arena, (arena_n + 1) * sizeof(arena[0]));
+		if (!blks)
+			return NULL;
+		arena = blks;
+		if (!(arena[arena_n] = malloc(MAX(len, SUBBLK))))
+			return NULL;
+		arena_n++;
+		arena_len = 0;
+	}
+	d = arena[arena_n - 1] + arena_len;
+	arena_len += len;
+	return d;
+}
+
+/* run-length encode argb rows as (count, colour) pairs ending with 0 */
+static int sub_rle(unsigned *rle, unsigned *argb, int w, int h)
+{
+	int n = 0;
+	int r, c;
+	for (r = 0; r < h; r++) {
+		unsigned *row = argb + r * w;
+		for (c = 0; c < w; ) {
+			int beg = c;
+			while (c < w && row[c] == row[beg])
+				c++;
+			if (rle) {
+				rle[n] = c - beg;
+				rle[n + 1] = row[beg];
+			}
+			n += 2;
+		}
+		if (rle)
+			rle[n] = 0;
+		n++;
+	}
+	return n;
+}
+
+/* decode the bitmap of sub into argb */
+void sub_bitmap(struct sub *sub, unsigned *argb)
+{
+	unsigned *rle = sub->img;
+	int r;
+	for (r = 0; r < sub->h; r++, rle++) {
+		unsigned *d = argb + r * sub->w;
+		for (; rle[0]; rle += 2) {
+			unsigned i;
+			for (i = 0; i < rle[0]; i++)
+				*d++ = rle[1];
+		}
+	}
+}
+
+static struct sub *sub_new(char *text, unsigned *argb, int *rect, int cw, int ch)
+{
+	struct sub *sub = arena_alloc(sizeof(*sub));
+	int len = strlen(text) + 1;
+	if (!sub)
+		return NULL;
+	memset(sub, 0, sizeof(*sub));
+	if (len > 1 && (sub->text = arena_alloc(len)))
+		memcpy(sub->text, text, len);
+	if (argb) {
+		int n = sub_rle(NULL, argb, rect[2], rect[3]);
+		if ((sub->img = arena_alloc(n * sizeof(unsigned)))) {
+			sub_rle(sub->img, argb, rect[2], rect[3]);
+			sub->x = rect[0];
+			sub->y = rect[1];
+			sub->w = rect[2];
+			sub->h = rect[3];
+			sub->cw = cw;
+			sub->ch = ch;
+		}
+	}
+	return sub;
+}
+
+static void subs_maxend(int i)
+{
+	for (; i < subs_n; i++)
+		subs[i].maxend = i ? MAX(subs[i - 1].maxend, subs[i].end) : subs[i].end;
+}
+
+static void subs_add(long beg, long end, struct sub *sub)
+{
+	int i;
+	if (subs_n == subs_sz) {
+		int sz = subs_sz ? subs_sz * 2 : 1024;
+		struct subent *n = realloc(subs, sz * sizeof(subs[0]));
+		if (!n)
+			return;
+		subs = n;
+		subs_sz = sz;
+	}
+	for (i = subs_n; i > 0 && subs[i - 1].beg > beg; i--)
+		;
+	if (i < subs_n) {
+		memmove(subs + i + 1, subs + i, (subs_n - i) * sizeof(subs[0]));
+		subs_gen++;
+	}
+	subs[i].beg = beg;
+	subs[i].end = end;
+	subs[i].sub = sub;
+	subs_n++;
+	subs_maxend(i);
+}
+
+/* hide subtitles without an end position when the next one appears */
+static void subs_close(long pos)
+{
+	int i;
+	for (i = subs_n - 1; i >= 0 && i >= subs_n - SUBACT; i--) {
+		if (subs[i].end == LONG_MAX && subs[i].beg <= pos) {
+			subs[i].end = pos;
+			subs_maxend(i);
+		}
+	}
+}
+
+static void *sub_load(void *dat)
+{
+	struct ffs *ffs = ffs_alloc(sub_path, FFS_SUBTS);
+	char buf[SUBTLEN];
+	unsigned *argb;
+	struct sub *sub;
+	long beg, end;
+	int rect[4];
+	int cw, ch;
+	int ret;
+	if (!ffs)
+		return NULL;
+	ffs_vinfo(ffs, &cw, &ch);
+	while (!sub_stop && (ret = ffs_sdec(ffs, buf, sizeof(buf), &beg, &end)) >= 0) {
+		if (ret)
+			continue;
+		argb = ffs_sbmp(ffs, rect);
+		pthread_mutex_lock(&subs_lock);
+		subs_close(beg);
+		pthread_mutex_unlock(&subs_lock);
+		if (!buf[0] && !argb)
+			continue;
+		if (!(sub = sub_new(buf, argb, rect, cw, ch)))
+			continue;
+		pthread_mutex_lock(&subs_lock);
+		subs_add(beg, end, sub);
+		pthread_mutex_unlock(&subs_lock);
+	}
+	ffs_free(ffs);
+	return NULL;
+}
+
+/* start loading the subtitles in path */
+int sub_open(char *path)
+{
+	sub_path = path;
+	sub_stop = 0;
+	sub_started = !pthread_create(&sub_thread, NULL, sub_load, NULL);
+	return !sub_started;
+}
+
+void sub_free(void)
+{
+	int i;
+	if (!sub_path)
+		return;
+	sub_stop = 1;
+	if (sub_started)
+		pthread_join(sub_thread, NULL);
+	sub_started = 0;
+	for (i = 0; i < arena_n; i++)
+		free(arena[i]);
+	free(arena);
+	free(subs);
+	arena = NULL;
+	subs = NULL;
+	arena_n = 0;
+	subs_n = 0;
+	subs_sz = 0;
+	sub_path = NULL;
+}
+
+/* find the position of the cursor and active subtitles by searching */
+static void cur_search(long pos)
+{
+	int l = 0;
+	int h = subs_n;
+	int i;
+	while (l < h) {
+		int m = (l + h) >> 1;
+		if (subs[m].beg <= pos)
+			l = m + 1;
+		else
+			h = m;
+	}
+	cur = l;
+	act_n = 0;
+	act_over = 0;
+	for (i = cur - 1; i >= 0 && subs[i].maxend >= pos; i--) {
+		if (subs[i].end >= pos && act_n == SUBACT)
+			act_over = 1;
+		if (subs[i].end >= pos && act_n < SUBACT)
+			act[act_n++] = i;
+	}
+	for (i = 0; i < act_n / 2; i++) {
+		int t = act[i];
+		act[i] = act[act_n - i - 1];
+		act[act_n - i - 1] = t;
+	}
+}
+
+/* advance the cursor; return nonzero if it is too far behind */
+static int cur_step(long pos)
+{
+	int i, j;
+	/* the subtitles left out of act[] may become visible again */
+	if (act_over)
+		return 1;
+	/* drop the expired subtitles before adding new ones */
+	for (i = 0, j = 0; i < act_n; i++)
+		if (subs[act[i]].end >= pos)
+			act[j++] = act[i];
+	act_n = j;
+	for (i = 0; cur < subs_n && subs[cur].beg <= pos; i++, cur++) {
+		if (i == SUBSTEP || (subs[cur].end >= pos && act_n == SUBACT))
+			return 1;
+		if (subs[cur].end >= pos)
+			act[act_n++] = cur;
+	}
+	return 0;
+}
+
+/* return the subtitles visible at pos */
+int sub_find(long pos, struct sub **sub, int n)
+{
+	int i;
+	pthread_mutex_lock(&subs_lock);
+	if (cur_gen != subs_gen || pos < cur_pos || cur_step(pos)) {
+		cur_search(pos);
+		cur_gen = subs_gen;
+	}
+	cur_pos = pos;
+	for (i = 0; i < act_n && i < n; i++)
+		sub[i] = subs[act[i]].sub;
+	pthread_mutex_unlock(&subs_lock);
+	return i;
+}
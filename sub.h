@@ -0,0 +1,12 @@
+/* subtitle store */
+struct sub {
+	char *text;		/* subtitle text */
+	unsigned *img;		/* run-length encoded ARGB bitmap */
+	int x, y, w, h;		/* bitmap position and size */
+	int cw, ch;		/* bitmap canvas size */
+};
+
+int sub_open(char *path);
+void sub_free(void);
+int sub_find(long pos, struct sub **subs, int n);
+void sub_bitmap(struct sub *sub, unsigned *argb);
@@ -0,0 +1,104 @@
+/*
+ * contact sheets
+ *
+ * Tiles are divided among worker threads.  Each worker opens its own
+ * stream, seeks to the positions of the tiles it takes, and decodes
+ * only key frames.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "draw.h"
+#include "ffs.h"
+#include "thumb.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+struct sheet {
+	char *path;		/* the video file */
+	int cols, rows;		/* sheet tiles */
+	int tw, th;		/* tile size */
+	unsigned fbm;		/* sheet pixel format */
+	char *img;		/* sheet pixels */
+	int linelen;		/* sheet line length */
+	long *pos;		/* the position of tiles */
+	int next;		/* the next tile to decode */
+	int done;		/* number of decoded tiles */
+	pthread_mutex_t lock;
+};
+
+static void *thumb_work(void *dat)
+{
+	struct sheet *sh = dat;
+	struct ffs *ffs = ffs_alloc(sh->path, FFS_VIDEO | FFS_1THREAD);
+	int bpp = FBM_BPP(sh->fbm);
+	int n = sh->cols * sh->rows;
+	int w, h, rn, cn;
+	float zoom;
+	long dur;
+	int i, r;
+	if (!ffs)
+		return NULL;
+	ffs_keyonly(ffs);
+	ffs_vinfo(ffs, &w, &h);
+	zoom = MIN((float) sh->tw / w, (float) sh->th / h);
+	ffs_vconf(ffs, zoom, sh->fbm);
+	rn = MIN(sh->th, h * zoom);
+	cn = MIN(sh->tw, w * zoom);
+	dur = ffs_duration(ffs);
+	while (1) {
+		char *cell;
+		void *buf;
+		int len;
+		pthread_mutex_lock(&sh->lock);
+		i = sh->next++;
+		pthread_mutex_unlock(&sh->lock);
+		if (i >= n)
+			break;
+		ffs_seek(ffs, ffs, dur * (2 * i + 1) / (2 * n));
+		if ((len = ffs_vdec(ffs, &buf)) <= 0)
+			continue;
+		sh->pos[i] = ffs_pos(ffs);
+		cell = sh->img + ((i / sh->cols) * sh->th + (sh->th - rn) / 2) * sh->linelen +
+			((i % sh->cols) * sh->tw + (sh->tw - cn) / 2) * bpp;
+		for (r = 0; r < rn; r++)
+			memcpy(cell + r * sh->linelen, buf + r * len, cn * bpp);
+		pthread_mutex_lock(&sh->lock);
+		sh->done++;
+		pthread_mutex_unlock(&sh->lock);
+	}
+	ffs_free(ffs);
+	return NULL;
+}
+
+/* draw the key frames of evenly spaced positions of path in a sheet */
+int thumb_sheet(char *path, int cols, int rows, int tw, int th,
+		unsigned fbm, char *img, int linelen, long *pos)
+{
+	struct sheet sh;
+	pthread_t *threads;
+	int n = MIN(sysconf(_SC_NPROCESSORS_ONLN), cols * rows);
+	int i;
+	memset(&sh, 0, sizeof(sh));
+	sh.path = path;
+	sh.cols = cols;
+	sh.rows = rows;
+	sh.tw = tw;
+	sh.th = th;
+	sh.fbm = fbm;
+	sh.img = img;
+	sh.linelen = linelen;
+	sh.pos = pos;
+	pthread_mutex_init(&sh.lock, NULL);
+	if (n < 1)
+		n = 1;
+	threads = malloc(n * sizeof(threads[0]));
+	for (i = 0; i < n; i++)
+		pthread_create(&threads[i], NULL, thumb_work, &sh);
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&sh.lock);
+	return sh.done == 0;
+}
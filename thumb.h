@@ -0,0 +1,3 @@
+/* contact sheets */
+int thumb_sheet(char *path, int cols, int rows, int tw, int th,
+		unsigned fbm, char *img, int linelen, long *pos);